@@ -1,20 +1,39 @@
+#include <algorithm>
 #include <array>
+#include <cctype>
+#include <cfloat>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "blockdetect.h"
 #include "VCL2/instrset.h"
 
 template <typename T, int range_size>
-static const float calculate_blockiness(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept
+static void calculate_profile(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
 {
-    const size_t pitch{ avs_get_pitch_p(frame, plane) / sizeof(T) };
-    const size_t width{ avs_get_row_size_p(frame, plane) / sizeof(T) };
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, plane) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, plane) / static_cast<int>(sizeof(T)) };
     const int height{ avs_get_height_p(frame, plane) };
     const T* srcp{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, plane)) };
 
-    std::unique_ptr<float[]> grad{ std::make_unique<float[]>(width * height) };
-    float ret{ 0.0f };
-
     // Calculate BS in horizontal and vertical directions according to (1)(2)(3).
     // Also try to find integer pixel periods (grids) even for scaled images.
     // In case of fractional periods, FFMAX of current and neighbor pixels
@@ -22,329 +41,3050 @@ static const float calculate_blockiness(AVS_VideoFrame* frame, const blockdetect
     // Skip linear correction term (4)(5), as it appears only valid for their own test samples.
 
     // horizontal blockiness (fixed width)
-    for (int y{ 1 }; y < height; ++y)
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
     {
-        for (int x{ 3 }; x < width - 4; ++x)
-        {
-            float temp{ 0.0f };
-            grad[y * width + x] = std::abs(srcp[y * pitch + x + 0] - srcp[y * pitch + x + 1]);
-            temp += std::abs(srcp[y * pitch + x + 1] - srcp[y * pitch + x + 2]);
-            temp += std::abs(srcp[y * pitch + x + 2] - srcp[y * pitch + x + 3]);
-            temp += std::abs(srcp[y * pitch + x + 3] - srcp[y * pitch + x + 4]);
-            temp += std::abs(srcp[y * pitch + x - 0] - srcp[y * pitch + x - 1]);
-            temp += std::abs(srcp[y * pitch + x - 1] - srcp[y * pitch + x - 2]);
-            temp += std::abs(srcp[y * pitch + x - 2] - srcp[y * pitch + x - 3]);
-
-            if (temp)
-                grad[y * width + x] /= temp;
-            else
-                grad[y * width + x] /= range_size;
-
-            // use first row to store acculated results
-            grad[x] += grad[y * width + x];
-        }
+        // use col to store accumulated results
+        for (int x{ std::max(x0, 3) }; x < std::min(x1, width - 4); ++x)
+            col[x] += normalized_gradient<T, range_size>(srcp + y * pitch + x, 1);
     }
 
-    // find horizontal period
-    for (int period{ d->period_min }; period < d->period_max + 1; ++period)
+    // vertical blockiness (fixed height)
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
     {
-        float temp;
-        float block{ 0.0f };
-        float nonblock{ 0.0f };
-        int block_count{ 0 };
-        int nonblock_count{ 0 };
+        // use row to store accumulated results
+        for (int x{ std::max(x0, 1) }; x < std::min(x1, width); ++x)
+            row[y] += normalized_gradient<T, range_size>(srcp + y * pitch + x, pitch);
+    }
+}
+
+template <typename T, int range_size>
+static void calculate_profile_uv(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept
+{
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, AVS_PLANAR_U) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, AVS_PLANAR_U) / static_cast<int>(sizeof(T)) };
+    const int height{ avs_get_height_p(frame, AVS_PLANAR_U) };
+    const T* srcp_u{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_U)) };
+    const T* srcp_v{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_V)) };
 
-        for (int x{ 3 }; x < width - 4; ++x)
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
+    {
+        for (int x{ std::max(x0, 3) }; x < std::min(x1, width - 4); ++x)
         {
-            if ((x % period) == (period - 1))
-            {
-                block += std::max(std::max(grad[x + 0], grad[x + 1]), grad[x - 1]);
-                block_count++;
-            }
-            else
-            {
-                nonblock += grad[x];
-                nonblock_count++;
-            }
+            col_u[x] += normalized_gradient<T, range_size>(srcp_u + y * pitch + x, 1);
+            col_v[x] += normalized_gradient<T, range_size>(srcp_v + y * pitch + x, 1);
         }
+    }
 
-        if (block_count && nonblock_count && nonblock)
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
+    {
+        for (int x{ std::max(x0, 1) }; x < std::min(x1, width); ++x)
         {
-            temp = (block / block_count) / (nonblock / nonblock_count);
-            ret = std::max(ret, temp);
+            row_u[y] += normalized_gradient<T, range_size>(srcp_u + y * pitch + x, pitch);
+            row_v[y] += normalized_gradient<T, range_size>(srcp_v + y * pitch + x, pitch);
         }
     }
+}
 
-    // vertical blockiness (fixed height)
-    for (int y{ 3 }; y < height - 4; ++y)
+// Profiles of the luma of the R, G and B planes when plane is AVS_PLANAR_R, of the plane otherwise.
+template <typename T, int range_size>
+static void calculate_profile_luma(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    if (plane != AVS_PLANAR_R)
+        return calculate_profile<T, range_size>(frame, plane, x0, x1, y0, y1, col, row);
+
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, AVS_PLANAR_G) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, AVS_PLANAR_G) / static_cast<int>(sizeof(T)) };
+    const int height{ avs_get_height_p(frame, AVS_PLANAR_G) };
+    const T* srcp_r{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_R)) };
+    const T* srcp_g{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_G)) };
+    const T* srcp_b{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_B)) };
+
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
     {
-        for (int x{ 1 }; x < width; ++x)
-        {
-            float temp = 0.0f;
-            grad[y * width + x] = std::abs(srcp[(y + 0) * pitch + x] - srcp[(y + 1) * pitch + x]);
-            temp += std::abs(srcp[(y + 1) * pitch + x] - srcp[(y + 2) * pitch + x]);
-            temp += std::abs(srcp[(y + 2) * pitch + x] - srcp[(y + 3) * pitch + x]);
-            temp += std::abs(srcp[(y + 3) * pitch + x] - srcp[(y + 4) * pitch + x]);
-            temp += std::abs(srcp[(y - 0) * pitch + x] - srcp[(y - 1) * pitch + x]);
-            temp += std::abs(srcp[(y - 1) * pitch + x] - srcp[(y - 2) * pitch + x]);
-            temp += std::abs(srcp[(y - 2) * pitch + x] - srcp[(y - 3) * pitch + x]);
+        for (int x{ std::max(x0, 3) }; x < std::min(x1, width - 4); ++x)
+            col[x] += normalized_gradient_luma<T, range_size>(srcp_r + y * pitch + x, srcp_g + y * pitch + x, srcp_b + y * pitch + x, 1);
+    }
 
-            if (temp)
-                grad[y * width + x] /= temp;
-            else
-                grad[y * width + x] /= range_size;
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
+    {
+        for (int x{ std::max(x0, 1) }; x < std::min(x1, width); ++x)
+            row[y] += normalized_gradient_luma<T, range_size>(srcp_r + y * pitch + x, srcp_g + y * pitch + x, srcp_b + y * pitch + x, pitch);
+    }
+}
 
-            // use first column to store accumulated results
-            grad[y * width] += grad[y * width + x];
-        }
+// Profiles of the samples srcp[x * step] of the rows srcp + y * pitch.
+template <typename T, int range_size>
+static void strided_profile(const T* srcp, const ptrdiff_t pitch, const int step, const int width, const int height,
+    const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
+    {
+        for (int x{ std::max(x0, 3) }; x < std::min(x1, width - 4); ++x)
+            col[x] += normalized_gradient<T, range_size>(srcp + y * pitch + x * step, step);
     }
 
-    // find vertical period
-    for (int period{ d->period_min }; period < d->period_max + 1; ++period)
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
     {
-        float temp;
-        float block{ 0.0f };
-        float nonblock{ 0.0f };
-        int block_count{ 0 };
-        int nonblock_count{ 0 };
+        for (int x{ std::max(x0, 1) }; x < std::min(x1, width); ++x)
+            row[y] += normalized_gradient<T, range_size>(srcp + y * pitch + x * step, pitch);
+    }
+}
+
+// YUY2: Y0 U Y1 V.
+static void calculate_profile_yuy2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    const int step{ (plane == AVS_PLANAR_Y) ? 2 : 4 };
+    const int offset{ (plane == AVS_PLANAR_Y) ? 0 : ((plane == AVS_PLANAR_U) ? 1 : 3) };
+
+    strided_profile<uint8_t, 256>(avs_get_read_ptr_p(frame, AVS_DEFAULT_PLANE) + offset, avs_get_pitch_p(frame, AVS_DEFAULT_PLANE), step,
+        avs_get_row_size_p(frame, AVS_DEFAULT_PLANE) / step, avs_get_height_p(frame, AVS_DEFAULT_PLANE), x0, x1, y0, y1, col, row);
+}
+
+// Packed RGB: B G R (A), bottom-up.
+template <typename T, int range_size, int components>
+static void calculate_profile_rgb(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, AVS_DEFAULT_PLANE) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, AVS_DEFAULT_PLANE) / static_cast<int>(sizeof(T)) / components };
+    const int height{ avs_get_height_p(frame, AVS_DEFAULT_PLANE) };
+    const int offset{ (plane == AVS_PLANAR_R) ? 2 : ((plane == AVS_PLANAR_G) ? 1 : ((plane == AVS_PLANAR_B) ? 0 : 3)) };
+
+    // start at the top row
+    const T* srcp{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_DEFAULT_PLANE)) + (height - 1) * pitch + offset };
+
+    strided_profile<T, range_size>(srcp, -pitch, components, width, height, x0, x1, y0, y1, col, row);
+}
+
+// Block/nonblock ratio of the period in profile[first..last - 1], 0 when it can't be calculated.
+static float period_score(const float* profile, const int first, const int last, const int period) noexcept
+{
+    float block{ 0.0f };
+    float nonblock{ 0.0f };
+    int block_count{ 0 };
+    int nonblock_count{ 0 };
 
-        for (int y{ 3 }; y < height - 4; y++)
+    for (int x{ first }; x < last; ++x)
+    {
+        if ((x % period) == (period - 1))
         {
-            if ((y % period) == (period - 1))
-            {
-                block += std::max(std::max(grad[(y + 0) * width], grad[(y + 1) * width]), grad[(y - 1) * width]);
-                block_count++;
-            }
-            else
-            {
-                nonblock += grad[y * width];
-                nonblock_count++;
-            }
+            block += std::max(std::max(profile[x + 0], profile[x + 1]), profile[x - 1]);
+            block_count++;
         }
-
-        if (block_count && nonblock_count && nonblock)
+        else
         {
-            temp = (block / block_count) / (nonblock / nonblock_count);
-            ret = std::max(ret, temp);
+            nonblock += profile[x];
+            nonblock_count++;
         }
     }
 
-    // return highest value of horz||vert
-    return ret;
+    if (block_count && nonblock_count && nonblock)
+        return (block / block_count) / (nonblock / nonblock_count);
+
+    return 0.0f;
 }
 
-static AVS_VideoFrame* AVSC_CC get_frame_blockdetect(AVS_FilterInfo* fi, int n)
+// Find the period with the highest block/nonblock ratio in [period_min, period_max].
+// The ratio of every period is stored in spectrum, if not null.
+static grid find_period(const float* profile, const int first, const int last, const int period_min, const int period_max, float* spectrum = nullptr) noexcept
 {
-    blockdetect* d{ reinterpret_cast<blockdetect*>(fi->user_data) };
-
-    AVS_VideoFrame* frame{ avs_get_frame(fi->child, n) };
-    if (!frame)
-        return nullptr;
+    grid ret{ 0.0f, 0 };
 
-    avs_make_property_writable(fi->env, &frame);
-    AVS_Map* props{ avs_get_frame_props_rw(fi->env, frame) };
+    for (int period{ period_min }; period < period_max + 1; ++period)
+    {
+        const float temp{ period_score(profile, first, last, period) };
 
-    const std::array<std::string, 4> blockiness_y{ "blockiness_y", "blockiness_u", "blockiness_v", "blockiness_a" };
-    const std::array<std::string, 4> blockiness_r{ "blockiness_r", "blockiness_g", "blockiness_b", "blockiness_a" };
-    constexpr std::array<int, 4> planes_y{ AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V, AVS_PLANAR_A };
-    constexpr std::array<int, 4> planes_r{ AVS_PLANAR_R, AVS_PLANAR_G, AVS_PLANAR_B, AVS_PLANAR_A };
+        if (temp > ret.score)
+            ret = { temp, period };
 
-    const std::array<std::string, 4>* block;
-    const std::array<int, 4>* planes;
+        if (spectrum)
+            spectrum[period - period_min] = temp;
+    }
 
-    if (avs_is_rgb(&fi->vi))
-    {
-        block = &blockiness_r;
-        planes = &planes_r;
+    return ret;
+}
 
-    }
-    else
+// Candidate periods of a subsampled plane derived from the luma period.
+// Falls back to the full range when luma has no grid.
+static void subsampled_periods(const blockdetect* d, const int luma_period, const int subsampling, int& period_min, int& period_max) noexcept
+{
+    if (luma_period == 0)
     {
-        block = &blockiness_y;
-        planes = &planes_y;
+        period_min = d->period_min;
+        period_max = d->period_max;
+        return;
     }
 
-    for (int i{ 0 }; i < avs_num_components(&fi->vi); ++i)
-    {
-        if (d->process[i])
-            avs_prop_set_float(fi->env, props, block->at(i).c_str(), d->calculate(frame, d, planes->at(i)), 0);
-    }
+    period_min = std::max(luma_period >> subsampling, 2);
+    period_max = std::max((luma_period + (1 << subsampling) - 1) >> subsampling, 2);
+}
 
-    return frame;
+// How many pooled windows are kept.
+constexpr size_t pool_windows{ 16 };
+
+// Height of the bands of rows of the incremental analysis.
+constexpr int band_height{ 16 };
+
+constexpr int temporal_size{ 32 };
+constexpr size_t temporal_words{ sizeof(temporal_entry) / sizeof(int) };
+// How many preceding frames are searched for a prior.
+constexpr int temporal_range{ 8 };
+// Minimum correlation of the folded profiles for the prior to be kept.
+constexpr float temporal_threshold{ 0.5f };
+
+static bool load_temporal(const blockdetect* d, const int n, temporal_entry& entry) noexcept
+{
+    temporal_slot& slot{ d->temporal[n % temporal_size] };
+    const unsigned seq{ slot.seq.load(std::memory_order_acquire) };
+
+    if (seq & 1)
+        return false;
+
+    int words[temporal_words];
+
+    for (size_t i{ 0 }; i < temporal_words; ++i)
+        words[i] = slot.words[i].load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (slot.seq.load(std::memory_order_relaxed) != seq)
+        return false;
+
+    memcpy(&entry, words, sizeof(entry));
+
+    return entry.n == n;
 }
 
-static void AVSC_CC free_blockdetect(AVS_FilterInfo* fi)
+static void store_temporal(const blockdetect* d, const temporal_entry& entry) noexcept
 {
-    blockdetect* d{ reinterpret_cast<blockdetect*>(fi->user_data) };
-    delete d;
+    temporal_slot& slot{ d->temporal[entry.n % temporal_size] };
+    unsigned seq{ slot.seq.load(std::memory_order_relaxed) };
+
+    // another thread is writing this slot
+    if ((seq & 1) || !slot.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+        return;
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    int words[temporal_words];
+    memcpy(words, &entry, sizeof(entry));
+
+    for (size_t i{ 0 }; i < temporal_words; ++i)
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+
+    slot.seq.store(seq + 2, std::memory_order_release);
 }
 
-static int AVSC_CC set_cache_hints_blockdetect(AVS_FilterInfo* fi, int cachehints, int frame_range)
+// Mean of the profile at every phase of the period.
+static void fold_profile(const float* profile, const int size, const int period, float* fold) noexcept
 {
-    return cachehints == AVS_CACHE_GET_MTMODE ? 1 : 0;
+    int count[64]{};
+    std::fill_n(fold, period, 0.0f);
+
+    for (int x{ 3 }; x < size - 4; ++x)
+    {
+        fold[x % period] += profile[x];
+        count[x % period]++;
+    }
+
+    for (int i{ 0 }; i < period; ++i)
+    {
+        if (count[i])
+            fold[i] /= count[i];
+    }
 }
 
-static AVS_Value AVSC_CC Create_blockdetect(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+static float correlation(const float* a, const float* b, const int size) noexcept
 {
-    enum { Clip, Period_min, Period_max, Planes, Opt };
+    float mean_a{ 0.0f };
+    float mean_b{ 0.0f };
 
-    blockdetect* d{ new blockdetect() };
+    for (int i{ 0 }; i < size; ++i)
+    {
+        mean_a += a[i];
+        mean_b += b[i];
+    }
 
-    AVS_FilterInfo* fi;
-    AVS_Clip* clip{ avs_new_c_filter(env, &fi, avs_array_elt(args, Clip), 1) };
+    mean_a /= size;
+    mean_b /= size;
 
-    const auto set_error{ [&](const char* error)
-        {
-            avs_release_clip(clip);
+    float cov{ 0.0f };
+    float var_a{ 0.0f };
+    float var_b{ 0.0f };
 
-            return avs_new_value_error(error);
-        }
-    };
+    for (int i{ 0 }; i < size; ++i)
+    {
+        cov += (a[i] - mean_a) * (b[i] - mean_b);
+        var_a += (a[i] - mean_a) * (a[i] - mean_a);
+        var_b += (b[i] - mean_b) * (b[i] - mean_b);
+    }
 
-    if (!avs_check_version(env, 9))
+    return (var_a && var_b) ? cov / std::sqrt(var_a * var_b) : 0.0f;
+}
+
+// Search the profile for a grid.
+// The prior period is evaluated alone as long as it isn't older than temporal_prior frames and the folded profile still correlates with it.
+static grid search_period(const blockdetect* d, const float* profile, const int size, int period_min, int period_max, const int n,
+    const temporal_grid* prior, temporal_grid* next, float* spectrum) noexcept
+{
+    int searched{ n };
+
+    if (prior && prior->period && n - prior->searched < d->temporal_prior)
     {
-        if (avs_check_version(env, 10))
+        float fold[64];
+        fold_profile(profile, size, prior->period, fold);
+
+        if (correlation(fold, prior->fold, prior->period) >= temporal_threshold)
         {
-            if (avs_get_env_property(env, AVS_AEP_INTERFACE_BUGFIX) < 2)
-                return set_error("BlockDetect: AviSynth+ version must be r3688 or later.");
+            period_min = period_max = prior->period;
+            searched = prior->searched;
         }
     }
-    else
-        return set_error("BlockDetect: AviSynth+ version must be r3688 or later.");
 
-    if (!avs_is_planar(&fi->vi))
-        return set_error("BlockDetect: clip must be in planar format.");
+    const bool full{ period_min == d->period_min && period_max == d->period_max };
+    const grid ret{ find_period(profile, 3, size - 4, period_min, period_max, (full) ? spectrum : nullptr) };
+
+    // the spectrum always covers the whole range
+    if (spectrum && !full)
+        find_period(profile, 3, size - 4, d->period_min, d->period_max, spectrum);
+
+    if (next)
+    {
+        next->searched = searched;
+        next->period = ret.period;
 
-    d->period_min = avs_defined(avs_array_elt(args, Period_min)) ? avs_as_int(avs_array_elt(args, Period_min)) : 3;
-    d->period_max = avs_defined(avs_array_elt(args, Period_max)) ? avs_as_int(avs_array_elt(args, Period_max)) : 24;
+        if (ret.period)
+            fold_profile(profile, size, ret.period, next->fold);
+    }
 
-    if (d->period_min < 2 || d->period_min > 32)
-        return set_error("BlockDetect: period_min must be between 2..32.");
-    if (d->period_max < 2 || d->period_max > 64)
-        return set_error("BlockDetect: period_max must be between 2..64.");
+    return ret;
+}
 
-    const int opt{ avs_defined(avs_array_elt(args, Opt)) ? avs_as_int(avs_array_elt(args, Opt)) : -1 };
-    if (opt < -1 || opt > 3)
-        return set_error("BlockDetect: opt must be between -1..3.");
+static blockiness calculate_blockiness(const blockdetect* d, const AVS_VideoInfo* vi, const int plane, const profile& p, const int n, const blockiness* luma,
+    const temporal_grid* prior, temporal_grid* next) noexcept
+{
+    int period_min_h{ d->period_min };
+    int period_max_h{ d->period_max };
+    int period_min_v{ d->period_min };
+    int period_max_v{ d->period_max };
 
-    const int iset{ instrset_detect() };
+    if (luma)
+    {
+        // YUY2 chroma is horizontally halved
+        const bool planar{ avs_is_planar(vi) != 0 };
+        subsampled_periods(d, luma->h.period, (planar) ? avs_get_plane_width_subsampling(vi, plane) : 1, period_min_h, period_max_h);
+        subsampled_periods(d, luma->v.period, (planar) ? avs_get_plane_height_subsampling(vi, plane) : 0, period_min_v, period_max_v);
+        prior = nullptr;
+    }
 
-    if (opt == 1 && iset < 2)
-        return set_error("BlockDetect: opt=1 requires SSE2.");
-    if (opt == 2 && iset < 8)
-        return set_error("BlockDetect: opt=2 requires AVX2.");
-    if (opt == 3 && iset < 10)
-        return set_error("BlockDetect: opt=3 requires AVX512F.");
+    blockiness res;
+    res.h = search_period(d, p.col.get(), p.width, period_min_h, period_max_h, n, prior ? &prior[0] : nullptr, next ? &next[0] : nullptr,
+        (d->spectrum) ? res.spectrum_h : nullptr);
+    res.v = search_period(d, p.row.get(), p.height, period_min_v, period_max_v, n, prior ? &prior[1] : nullptr, next ? &next[1] : nullptr,
+        (d->spectrum) ? res.spectrum_v : nullptr);
 
-    const int num_planes{ (avs_defined(avs_array_elt(args, Planes))) ? avs_array_size(avs_array_elt(args, Planes)) : 0 };
+    return res;
+}
 
-    for (int i{ 0 }; i < 4; ++i)
-        d->process[i] = (num_planes <= 0);
+static int plane_id(const AVS_VideoInfo* vi, const int i) noexcept
+{
+    constexpr std::array<int, 4> planes_y{ AVS_PLANAR_Y, AVS_PLANAR_U, AVS_PLANAR_V, AVS_PLANAR_A };
+    constexpr std::array<int, 4> planes_r{ AVS_PLANAR_R, AVS_PLANAR_G, AVS_PLANAR_B, AVS_PLANAR_A };
 
-    for (int i{ 0 }; i < num_planes; ++i)
-    {
-        const int n{ avs_as_int(*(avs_as_array(avs_array_elt(args, Planes)) + i)) };
+    return (avs_is_rgb(vi)) ? planes_r[i] : planes_y[i];
+}
 
-        if (n >= avs_num_components(&fi->vi))
-            return set_error("BlockDetect: plane index out of range");
+// Frame property name of the plane i, rgb_mode="luma" stores the luma of RGB as blockiness_y.
+static std::string plane_name(const AVS_VideoInfo* vi, const blockdetect* d, const int i)
+{
+    constexpr std::array<const char*, 4> blockiness_y{ "blockiness_y", "blockiness_u", "blockiness_v", "blockiness_a" };
+    constexpr std::array<const char*, 4> blockiness_r{ "blockiness_r", "blockiness_g", "blockiness_b", "blockiness_a" };
 
-        if (d->process[n])
-            return set_error("BlockDetect: plane specified twice");
+    return (avs_is_rgb(vi) && !(d && d->rgb_luma)) ? blockiness_r[i] : blockiness_y[i];
+}
 
-        d->process[n] = true;
+// Width and height in samples of a plane, packed formats have the components of a pixel next to each other.
+static void plane_dimensions(AVS_VideoFrame* frame, const AVS_VideoInfo* vi, const int plane, int& width, int& height) noexcept
+{
+    if (avs_is_planar(vi))
+    {
+        width = avs_get_row_size_p(frame, plane) / avs_component_size(vi);
+        height = avs_get_height_p(frame, plane);
+    }
+    else
+    {
+        width = (avs_is_yuy2(vi) && plane != AVS_PLANAR_Y) ? vi->width / 2 : vi->width;
+        height = vi->height;
     }
+}
 
-    if ((opt == -1 && iset >= 10) || opt == 3)
+// Frame n of the child. With lookahead the workers fetch frames too, so the fetches are serialized:
+// AviSynth serializes the upstream filters only for its own (Prefetch) threads.
+static AVS_VideoFrame* get_child_frame(AVS_FilterInfo* fi, const blockdetect* d, const int n)
+{
+    if (!d->prefetched)
+        return avs_get_frame(fi->child, n);
+
+    std::lock_guard<std::mutex> lock(d->prefetched->fetch);
+    return avs_get_frame(fi->child, n);
+}
+
+// Add the profiles of the processed planes of the frame.
+static void accumulate_profiles(AVS_VideoFrame* frame, const blockdetect* d, const AVS_VideoInfo* vi, std::array<profile, 4>& profiles)
+{
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
     {
-        switch (avs_component_size(&fi->vi))
+        if (d->process[i])
         {
-            case 1: d->calculate = calculate_blockiness_avx512<uint8_t, 256>; break;
-            case 2:
+            const int plane{ plane_id(vi, i) };
+            profile& p{ profiles[i] };
+
+            if (!p.col)
+            {
+                plane_dimensions(frame, vi, plane, p.width, p.height);
+                p.col = std::make_unique<float[]>(p.width);
+                p.row = std::make_unique<float[]>(p.height);
+            }
+
+            // V is added together with U
+            if (d->calculate_uv && i == 2)
+                continue;
+
+            if (d->calculate_uv && i == 1)
             {
-                switch (avs_bits_per_component(&fi->vi))
+                if (!profiles[2].col)
                 {
-                    case 10: d->calculate = calculate_blockiness_avx512<uint16_t, 1024>; break;
-                    case 12: d->calculate = calculate_blockiness_avx512<uint16_t, 4096>; break;
-                    case 14: d->calculate = calculate_blockiness_avx512<uint16_t, 16384>; break;
-                    default: d->calculate = calculate_blockiness_avx512<uint16_t, 65536>;
+                    plane_dimensions(frame, vi, AVS_PLANAR_V, profiles[2].width, profiles[2].height);
+                    profiles[2].col = std::make_unique<float[]>(profiles[2].width);
+                    profiles[2].row = std::make_unique<float[]>(profiles[2].height);
                 }
-                break;
+
+                d->calculate_uv(frame, 0, p.width, 0, p.height, p.col.get(), p.row.get(), profiles[2].col.get(), profiles[2].row.get());
             }
-            default: d->calculate = calculate_blockiness_avx512<float, 1>;
+            else
+                d->calculate(frame, plane, 0, p.width, 0, p.height, p.col.get(), p.row.get());
         }
     }
-    else if ((opt == -1 && iset >= 8) || opt == 2)
+}
+
+static std::array<blockiness, 4> search_profiles(const blockdetect* d, const AVS_VideoInfo* vi, const std::array<profile, 4>& profiles, const int n,
+    const temporal_entry* prior, temporal_entry* next) noexcept
+{
+    // chroma planes reuse the luma grid
+    const bool luma_grid{ d->luma_grid && avs_is_yuv(vi) };
+    std::array<blockiness, 4> res{};
+
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        if (d->process[i])
+            res[i] = calculate_blockiness(d, vi, plane_id(vi, i), profiles[i], n, (luma_grid && (i == 1 || i == 2)) ? &res[0] : nullptr,
+                prior ? prior->grid[i] : nullptr, next ? next->grid[i] : nullptr);
+    }
+
+    return res;
+}
+
+// Every period configuration searches the same profiles.
+static void search_configs(const blockdetect* d, const AVS_VideoInfo* vi, const std::array<profile, 4>& profiles, analysis& res) noexcept
+{
+    res.configs.resize(d->configs.size());
+
+    for (size_t c{ 0 }; c < d->configs.size(); ++c)
     {
-        switch (avs_component_size(&fi->vi))
+        for (int i{ 0 }; i < avs_num_components(vi); ++i)
         {
-            case 1: d->calculate = calculate_blockiness_avx2<uint8_t, 256>; break;
-            case 2:
+            if (d->process[i])
             {
-                switch (avs_bits_per_component(&fi->vi))
-                {
-                    case 10: d->calculate = calculate_blockiness_avx2<uint16_t, 1024>; break;
-                    case 12: d->calculate = calculate_blockiness_avx2<uint16_t, 4096>; break;
-                    case 14: d->calculate = calculate_blockiness_avx2<uint16_t, 16384>; break;
-                    default: d->calculate = calculate_blockiness_avx2<uint16_t, 65536>;
-                }
-                break;
+                const profile& p{ profiles[i] };
+                const period_config& config{ d->configs[c] };
+
+                res.configs[c][i] = std::max(find_period(p.col.get(), 3, p.width - 4, config.period_min, config.period_max).score,
+                    find_period(p.row.get(), 3, p.height - 4, config.period_min, config.period_max).score);
             }
-            default: d->calculate = calculate_blockiness_avx2<float, 1>;
         }
     }
-    else if ((opt == -1 && iset >= 2) || opt == 1)
+}
+
+// Profiles of all frames of the window are added and searched once for the whole window.
+static analysis pool_blockiness(AVS_FilterInfo* fi, const blockdetect* d, AVS_VideoFrame* frame, const int n)
+{
+    const int window{ n / d->pool };
+
+    std::promise<analysis> promise;
+    std::shared_future<analysis> res;
+    bool owner{ false };
+
     {
-        switch (avs_component_size(&fi->vi))
+        std::lock_guard<std::mutex> lock(d->pooled->mutex);
+
+        auto it{ d->pooled->windows.find(window) };
+
+        if (it != d->pooled->windows.end())
+            res = it->second;
+        else
         {
-            case 1: d->calculate = calculate_blockiness_sse2<uint8_t, 256>; break;
-            case 2:
+            res = promise.get_future().share();
+            d->pooled->windows.emplace(window, res);
+            owner = true;
+
+            if (d->pooled->windows.size() > pool_windows)
             {
-                switch (avs_bits_per_component(&fi->vi))
-                {
-                    case 10: d->calculate = calculate_blockiness_sse2<uint16_t, 1024>; break;
-                    case 12: d->calculate = calculate_blockiness_sse2<uint16_t, 4096>; break;
-                    case 14: d->calculate = calculate_blockiness_sse2<uint16_t, 16384>; break;
-                    default: d->calculate = calculate_blockiness_sse2<uint16_t, 65536>;
-                }
-                break;
+                // drop the window farthest from the current one
+                if (window - d->pooled->windows.begin()->first > std::prev(d->pooled->windows.end())->first - window)
+                    d->pooled->windows.erase(d->pooled->windows.begin());
+                else
+                    d->pooled->windows.erase(std::prev(d->pooled->windows.end()));
             }
-            default: d->calculate = calculate_blockiness_sse2<float, 1>;
         }
     }
-    else
+
+    if (owner)
     {
-        switch (avs_component_size(&fi->vi))
+        std::array<profile, 4> profiles;
+        const int first{ window * d->pool };
+        const int last{ std::min(first + d->pool, fi->vi.num_frames) };
+
+        for (int m{ first }; m < last; ++m)
         {
-            case 1: d->calculate = calculate_blockiness<uint8_t, 256>; break;
-            case 2:
+            if (m == n)
             {
-                switch (avs_bits_per_component(&fi->vi))
-                {
-                    case 10: d->calculate = calculate_blockiness<uint16_t, 1024>; break;
-                    case 12: d->calculate = calculate_blockiness<uint16_t, 4096>; break;
-                    case 14: d->calculate = calculate_blockiness<uint16_t, 16384>; break;
-                    default: d->calculate = calculate_blockiness<uint16_t, 65536>;
-                }
-                break;
+                accumulate_profiles(frame, d, &fi->vi, profiles);
+                continue;
             }
-            default: d->calculate = calculate_blockiness<float, 1>;
+
+            AVS_VideoFrame* src{ get_child_frame(fi, d, m) };
+            if (!src)
+                continue;
+
+            accumulate_profiles(src, d, &fi->vi, profiles);
+            avs_release_video_frame(src);
         }
+
+        analysis pooled;
+        pooled.planes = search_profiles(d, &fi->vi, profiles, n, nullptr, nullptr);
+        search_configs(d, &fi->vi, profiles, pooled);
+
+        if (d->profiles)
+            pooled.profiles = std::make_shared<const std::array<profile, 4>>(std::move(profiles));
+
+        promise.set_value(std::move(pooled));
     }
 
-    AVS_Value v{ avs_new_value_clip(clip) };
+    return res.get();
+}
 
-    fi->user_data = reinterpret_cast<void*>(d);
-    fi->get_frame = get_frame_blockdetect;
-    fi->set_cache_hints = set_cache_hints_blockdetect;
-    fi->free_filter = free_blockdetect;
+// Only the bands of rows that differ from the previous frame are analyzed again.
+// The state is taken out of the cache while in use, so concurrent requests fall back to a full analysis.
+static void incremental_profiles(const blockdetect* d, const AVS_VideoInfo* vi, AVS_VideoFrame* frame, const int n, std::array<profile, 4>& profiles)
+{
+    std::unique_ptr<incremental_state> state;
 
-    avs_release_clip(clip);
+    {
+        std::lock_guard<std::mutex> lock(d->incremental->mutex);
+        state = std::move(d->incremental->state);
+    }
 
-    return v;
+    const bool reuse{ state && state->n == n - 1 };
+
+    if (!state)
+        state = std::make_unique<incremental_state>();
+
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        if (!d->process[i])
+            continue;
+
+        const int plane{ plane_id(vi, i) };
+        const int row_size{ avs_get_row_size_p(frame, plane) };
+        const int width{ row_size / avs_component_size(vi) };
+        const int height{ avs_get_height_p(frame, plane) };
+        const int bands{ (height + band_height - 1) / band_height };
+
+        incremental_plane& prev{ state->planes[i] };
+        std::vector<char> changed(height, 1);
+
+        if (reuse)
+        {
+            const int prev_pitch{ avs_get_pitch_p(state->frame, plane) };
+            const int pitch{ avs_get_pitch_p(frame, plane) };
+            const uint8_t* prevp{ avs_get_read_ptr_p(state->frame, plane) };
+            const uint8_t* srcp{ avs_get_read_ptr_p(frame, plane) };
+
+            for (int y{ 0 }; y < height; ++y)
+                changed[y] = memcmp(prevp + y * prev_pitch, srcp + y * pitch, row_size) != 0;
+        }
+        else
+        {
+            prev.bands = std::make_unique<float[]>(static_cast<size_t>(bands) * width);
+            prev.row = std::make_unique<float[]>(height);
+        }
+
+        for (int b{ 0 }; b < bands; ++b)
+        {
+            const int y0{ b * band_height };
+            const int y1{ std::min(y0 + band_height, height) };
+
+            // the gradients of rows y0..y1 - 1 use rows y0 - 3..y1 + 3
+            const auto first{ changed.begin() + std::max(y0 - 3, 0) };
+            const auto last{ changed.begin() + std::min(y1 + 4, height) };
+
+            if (std::find(first, last, 1) == last)
+                continue;
+
+            float* band{ prev.bands.get() + static_cast<size_t>(b) * width };
+            std::fill_n(band, width, 0.0f);
+            std::fill(prev.row.get() + y0, prev.row.get() + y1, 0.0f);
+
+            d->calculate(frame, plane, 0, width, y0, y1, band, prev.row.get());
+        }
+
+        profile& p{ profiles[i] };
+        p.width = width;
+        p.height = height;
+        p.col = std::make_unique<float[]>(width);
+        p.row = std::make_unique<float[]>(height);
+
+        for (int b{ 0 }; b < bands; ++b)
+        {
+            const float* band{ prev.bands.get() + static_cast<size_t>(b) * width };
+
+            for (int x{ 0 }; x < width; ++x)
+                p.col[x] += band[x];
+        }
+
+        std::copy_n(prev.row.get(), height, p.row.get());
+    }
+
+    if (state->frame)
+        avs_release_video_frame(state->frame);
+
+    state->frame = avs_copy_video_frame(frame);
+    state->n = n;
+
+    std::lock_guard<std::mutex> lock(d->incremental->mutex);
+
+    if (!d->incremental->state || d->incremental->state->n < n)
+        d->incremental->state.swap(state);
+}
+
+// Hash of the processed planes.
+// Four independent lanes keep the multiplications from serializing.
+static uint64_t hash_frame(AVS_VideoFrame* frame, const blockdetect* d, const AVS_VideoInfo* vi) noexcept
+{
+    constexpr uint64_t prime{ 0x100000001b3 };
+    uint64_t lanes[4]{ 0xcbf29ce484222325, 0x84222325cbf29ce4, 0xcbf29ce484222325 ^ 1, 0x84222325cbf29ce4 ^ 1 };
+
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        // plane 0 of rgb_luma reads the first three planes
+        if (!d->process[i] && !(d->rgb_luma && d->process[0] && i < 3))
+            continue;
+
+        // packed formats have all components in one plane
+        const int plane{ (avs_is_planar(vi)) ? plane_id(vi, i) : AVS_DEFAULT_PLANE };
+        const int pitch{ avs_get_pitch_p(frame, plane) };
+        const int row_size{ avs_get_row_size_p(frame, plane) };
+        const int height{ avs_get_height_p(frame, plane) };
+        const uint8_t* srcp{ avs_get_read_ptr_p(frame, plane) };
+
+        for (int y{ 0 }; y < height; ++y)
+        {
+            int x{ 0 };
+
+            for (; x + 32 <= row_size; x += 32)
+            {
+                uint64_t w[4];
+                memcpy(w, srcp + x, sizeof(w));
+
+                for (int j{ 0 }; j < 4; ++j)
+                    lanes[j] = (lanes[j] ^ w[j]) * prime;
+            }
+
+            for (; x < row_size; ++x)
+                lanes[0] = (lanes[0] ^ srcp[x]) * prime;
+
+            srcp += pitch;
+        }
+
+        if (!avs_is_planar(vi))
+            break;
+    }
+
+    return ((lanes[0] * prime ^ lanes[1]) * prime ^ lanes[2]) * prime ^ lanes[3];
+}
+
+static bool find_duplicate(const blockdetect* d, const uint64_t hash, analysis& res)
+{
+    std::lock_guard<std::mutex> lock(d->dedup->mutex);
+
+    for (const dedup_entry& entry : d->dedup->entries)
+    {
+        if (entry.valid && entry.hash == hash)
+        {
+            res = entry.res;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void store_duplicate(const blockdetect* d, const uint64_t hash, const analysis& res)
+{
+    std::lock_guard<std::mutex> lock(d->dedup->mutex);
+
+    dedup_entry& entry{ d->dedup->entries[d->dedup->next] };
+    entry = { hash, true, res };
+    d->dedup->next = (d->dedup->next + 1) % d->dedup->entries.size();
+}
+
+// Map size bytes of the file. The content is kept only if the file already has this size, otherwise it's zeroed.
+static void* map_file(const char* path, const size_t size) noexcept
+{
+#ifdef _WIN32
+    HANDLE file{ CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr) };
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER current;
+
+    if (!GetFileSizeEx(file, &current) || static_cast<uint64_t>(current.QuadPart) != size)
+    {
+        // the mapping extends the truncated file with zeros
+        if (!SetFilePointerEx(file, LARGE_INTEGER{}, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+        {
+            CloseHandle(file);
+            return nullptr;
+        }
+    }
+
+    HANDLE mapping{ CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr) };
+    CloseHandle(file);
+
+    if (!mapping)
+        return nullptr;
+
+    // the view keeps the mapping open
+    void* view{ MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) };
+    CloseHandle(mapping);
+
+    return view;
+#else
+    const int fd{ open(path, O_RDWR | O_CREAT, 0644) };
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) != size)
+    {
+        if (ftruncate(fd, 0) || ftruncate(fd, static_cast<off_t>(size)))
+        {
+            close(fd);
+            return nullptr;
+        }
+    }
+
+    void* view{ mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) };
+    close(fd);
+
+    return (view == MAP_FAILED) ? nullptr : view;
+#endif
+}
+
+result_cache::~result_cache()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+}
+
+// Identity of the cached results: the format, the parameters that change the results and the first and the last frame of the source.
+static uint64_t cache_hash(AVS_FilterInfo* fi, const blockdetect* d) noexcept
+{
+    constexpr uint64_t prime{ 0x100000001b3 };
+    const int params[]{ fi->vi.width, fi->vi.height, fi->vi.pixel_type, fi->vi.num_frames, d->period_min, d->period_max,
+        d->process[0], d->process[1], d->process[2], d->process[3], d->rgb_luma, d->luma_grid, d->temporal_prior, d->pool };
+
+    uint64_t hash{ 0xcbf29ce484222325 };
+
+    for (const int param : params)
+        hash = (hash ^ static_cast<uint32_t>(param)) * prime;
+
+    for (const int n : { 0, fi->vi.num_frames - 1 })
+    {
+        AVS_VideoFrame* frame{ avs_get_frame(fi->child, n) };
+
+        if (frame)
+        {
+            hash = (hash ^ hash_frame(frame, d, &fi->vi)) * prime;
+            avs_release_video_frame(frame);
+        }
+    }
+
+    return hash;
+}
+
+// A cache file of other results is cleared. Records not marked valid (for example, of a crashed session) are computed again.
+static std::unique_ptr<result_cache> open_cache(const char* path, const uint64_t hash, const int num_frames)
+{
+    constexpr char magic[8]{ 'B', 'D', 'C', 'A', 'C', 'H', 'E', '1' };
+
+    std::unique_ptr<result_cache> cache{ std::make_unique<result_cache>() };
+    cache->size = sizeof(cache_header) + sizeof(cache_record) * num_frames;
+    cache->view = map_file(path, cache->size);
+
+    if (!cache->view)
+        return nullptr;
+
+    cache->header = reinterpret_cast<cache_header*>(cache->view);
+    cache->records = reinterpret_cast<cache_record*>(reinterpret_cast<uint8_t*>(cache->view) + sizeof(cache_header));
+
+    cache_header& header{ *cache->header };
+
+    if (memcmp(header.magic, magic, sizeof(magic)) || header.hash != hash || header.num_frames != num_frames || header.record_size != sizeof(cache_record))
+    {
+        // the header is written last, a reset interrupted by a crash is repeated
+        memset(cache->view, 0, cache->size);
+        header.hash = hash;
+        header.num_frames = num_frames;
+        header.record_size = sizeof(cache_record);
+        memcpy(header.magic, magic, sizeof(magic));
+    }
+
+    return cache;
+}
+
+static bool load_cached(const blockdetect* d, const int n, analysis& res) noexcept
+{
+    if (n < 0 || n >= d->cache->header->num_frames)
+        return false;
+
+    const cache_record& record{ d->cache->records[n] };
+
+    if (!record.valid.load(std::memory_order_acquire))
+        return false;
+
+    for (int i{ 0 }; i < 4; ++i)
+    {
+        res.planes[i].h = record.planes[i][0];
+        res.planes[i].v = record.planes[i][1];
+    }
+
+    return true;
+}
+
+static void store_cached(const blockdetect* d, const int n, const analysis& res)
+{
+    if (n < 0 || n >= d->cache->header->num_frames)
+        return;
+
+    std::lock_guard<std::mutex> lock(d->cache->mutex);
+    cache_record& record{ d->cache->records[n] };
+
+    // the results of a valid record are never written again, so they can be read without the lock
+    if (record.valid.load(std::memory_order_relaxed))
+        return;
+
+    for (int i{ 0 }; i < 4; ++i)
+    {
+        record.planes[i][0] = res.planes[i].h;
+        record.planes[i][1] = res.planes[i].v;
+    }
+
+    record.valid.store(1, std::memory_order_release);
+}
+
+// Add the profiles of the tiles with edges xs and ys. Every tile adds to the horizontal profile of its row of tiles (cols, width values each)
+// and to the vertical profile of its column of tiles (rows, height values each).
+static void accumulate_tiles(AVS_VideoFrame* frame, const profile_kernel calculate, const int plane, const int width, const int height,
+    const std::vector<int>& xs, const std::vector<int>& ys, float* cols, float* rows) noexcept
+{
+    for (size_t ty{ 0 }; ty + 1 < ys.size(); ++ty)
+    {
+        for (size_t tx{ 0 }; tx + 1 < xs.size(); ++tx)
+            calculate(frame, plane, xs[tx], xs[tx + 1], ys[ty], ys[ty + 1], cols + ty * width, rows + tx * height);
+    }
+}
+
+// The profiles of the tiles add up to the profiles of the whole plane.
+static void tile_profiles(AVS_VideoFrame* frame, const blockdetect* d, const AVS_VideoInfo* vi, std::array<profile, 4>& profiles, analysis& res)
+{
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        if (!d->process[i])
+            continue;
+
+        const int plane{ plane_id(vi, i) };
+        int width;
+        int height;
+        plane_dimensions(frame, vi, plane, width, height);
+
+        std::vector<int> xs(d->tiles_x + 1);
+        std::vector<int> ys(d->tiles_y + 1);
+
+        for (int tx{ 0 }; tx < d->tiles_x + 1; ++tx)
+            xs[tx] = tx * width / d->tiles_x;
+        for (int ty{ 0 }; ty < d->tiles_y + 1; ++ty)
+            ys[ty] = ty * height / d->tiles_y;
+
+        std::unique_ptr<float[]> cols{ std::make_unique<float[]>(static_cast<size_t>(d->tiles_y) * width) };
+        std::unique_ptr<float[]> rows{ std::make_unique<float[]>(static_cast<size_t>(d->tiles_x) * height) };
+
+        accumulate_tiles(frame, d->calculate, plane, width, height, xs, ys, cols.get(), rows.get());
+
+        res.tiles[i].resize(static_cast<size_t>(d->tiles_x) * d->tiles_y);
+
+        for (int ty{ 0 }; ty < d->tiles_y; ++ty)
+        {
+            for (int tx{ 0 }; tx < d->tiles_x; ++tx)
+            {
+                res.tiles[i][static_cast<size_t>(ty) * d->tiles_x + tx] = std::max(
+                    find_period(cols.get() + static_cast<size_t>(ty) * width, std::max(xs[tx], 3), std::min(xs[tx + 1], width - 4), d->period_min, d->period_max).score,
+                    find_period(rows.get() + static_cast<size_t>(tx) * height, std::max(ys[ty], 3), std::min(ys[ty + 1], height - 4), d->period_min, d->period_max).score);
+            }
+        }
+
+        profile& p{ profiles[i] };
+        p.width = width;
+        p.height = height;
+        p.col = std::make_unique<float[]>(width);
+        p.row = std::make_unique<float[]>(height);
+
+        for (int ty{ 0 }; ty < d->tiles_y; ++ty)
+        {
+            for (int x{ 0 }; x < width; ++x)
+                p.col[x] += cols[static_cast<size_t>(ty) * width + x];
+        }
+
+        for (int tx{ 0 }; tx < d->tiles_x; ++tx)
+        {
+            for (int y{ 0 }; y < height; ++y)
+                p.row[y] += rows[static_cast<size_t>(tx) * height + y];
+        }
+    }
+}
+
+static analysis analyze_frame(AVS_FilterInfo* fi, const blockdetect* d, AVS_VideoFrame* frame, const int n)
+{
+    if (d->pool > 1)
+        return pool_blockiness(fi, d, frame, n);
+
+    // the most recent of the preceding frames that are already processed
+    std::unique_ptr<temporal_entry> prior;
+    std::unique_ptr<temporal_entry> next;
+
+    if (d->temporal_prior)
+    {
+        prior = std::make_unique<temporal_entry>();
+        next = std::make_unique<temporal_entry>();
+        next->n = n;
+
+        int m{ n - 1 };
+
+        for (; m >= std::max(n - temporal_range, 0); --m)
+        {
+            if (load_temporal(d, m, *prior))
+                break;
+        }
+
+        if (m < std::max(n - temporal_range, 0))
+            prior.reset();
+    }
+
+    std::array<profile, 4> profiles;
+    analysis res;
+
+    if (d->tiles_x)
+        tile_profiles(frame, d, &fi->vi, profiles, res);
+    else if (d->incremental)
+        incremental_profiles(d, &fi->vi, frame, n, profiles);
+    else
+        accumulate_profiles(frame, d, &fi->vi, profiles);
+
+    res.planes = search_profiles(d, &fi->vi, profiles, n, prior.get(), next.get());
+    search_configs(d, &fi->vi, profiles, res);
+
+    if (next)
+        store_temporal(d, *next);
+
+    if (d->profiles)
+        res.profiles = std::make_shared<const std::array<profile, 4>>(std::move(profiles));
+
+    return res;
+}
+
+// Analyze the frames queued by lookahead_blockiness.
+static void lookahead_worker(AVS_FilterInfo* fi, const blockdetect* d)
+{
+    lookahead_cache& cache{ *d->prefetched };
+
+    while (true)
+    {
+        std::pair<int, std::promise<analysis>> job;
+
+        {
+            std::unique_lock<std::mutex> lock(cache.mutex);
+            cache.cond.wait(lock, [&]() { return cache.stop || !cache.jobs.empty(); });
+
+            if (cache.stop)
+                return;
+
+            job = std::move(cache.jobs.front());
+            cache.jobs.pop_front();
+        }
+
+        AVS_VideoFrame* frame{ get_child_frame(fi, d, job.first) };
+
+        if (!frame)
+        {
+            job.second.set_exception(std::make_exception_ptr(std::runtime_error("BlockDetect: failed to get the frame.")));
+            continue;
+        }
+
+        job.second.set_value(analyze_frame(fi, d, frame, job.first));
+        avs_release_video_frame(frame);
+    }
+}
+
+// Serve frame n from the frames analyzed ahead, then queue the next frames for the workers.
+static analysis lookahead_blockiness(AVS_FilterInfo* fi, const blockdetect* d, AVS_VideoFrame* frame, const int n)
+{
+    lookahead_cache& cache{ *d->prefetched };
+    std::shared_future<analysis> res;
+
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+
+        auto it{ cache.frames.find(n) };
+        if (it != cache.frames.end())
+            res = it->second;
+
+        // keep the frames around n, some lag behind in MT
+        cache.frames.erase(cache.frames.begin(), cache.frames.lower_bound(n - d->lookahead));
+        cache.frames.erase(cache.frames.upper_bound(n + d->lookahead), cache.frames.end());
+
+        for (int m{ n + 1 }; m < std::min(n + d->lookahead + 1, fi->vi.num_frames) && cache.jobs.size() < static_cast<size_t>(d->lookahead); ++m)
+        {
+            if (cache.frames.count(m))
+                continue;
+
+            std::promise<analysis> promise;
+            cache.frames.emplace(m, promise.get_future().share());
+            cache.jobs.emplace_back(m, std::move(promise));
+        }
+    }
+
+    cache.cond.notify_all();
+
+    if (res.valid())
+    {
+        try
+        {
+            return res.get();
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+
+    return analyze_frame(fi, d, frame, n);
+}
+
+static void set_float_array(AVS_ScriptEnvironment* env, AVS_Map* props, const std::string& key, const float* values, const int size)
+{
+    std::unique_ptr<double[]> temp{ std::make_unique<double[]>(size) };
+    std::copy_n(values, size, temp.get());
+    avs_prop_set_float_array(env, props, key.c_str(), temp.get(), size);
+}
+
+static void set_properties(AVS_ScriptEnvironment* env, AVS_Map* props, const blockdetect* d, const AVS_VideoInfo* vi, const analysis& res)
+{
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        if (!d->process[i])
+            continue;
+
+        const blockiness& plane{ res.planes[i] };
+        const std::string block{ plane_name(vi, d, i) };
+
+        // return highest value of horz||vert
+        avs_prop_set_float(env, props, block.c_str(), std::max(plane.h.score, plane.v.score), 0);
+
+        if (d->split)
+        {
+            avs_prop_set_float(env, props, (block + "_h").c_str(), plane.h.score, 0);
+            avs_prop_set_float(env, props, (block + "_v").c_str(), plane.v.score, 0);
+            avs_prop_set_int(env, props, (block + "_period_h").c_str(), plane.h.period, 0);
+            avs_prop_set_int(env, props, (block + "_period_v").c_str(), plane.v.period, 0);
+        }
+
+        if (d->spectrum)
+        {
+            const int size{ std::max(d->period_max - d->period_min + 1, 0) };
+
+            set_float_array(env, props, block + "_spectrum_h", plane.spectrum_h, size);
+            set_float_array(env, props, block + "_spectrum_v", plane.spectrum_v, size);
+        }
+
+        for (size_t c{ 0 }; c < d->configs.size(); ++c)
+            avs_prop_set_float(env, props, (block + "_" + d->configs[c].name).c_str(), res.configs[c][i], 0);
+
+        if (d->tiles_x)
+            set_float_array(env, props, block + "_tiles", res.tiles[i].data(), static_cast<int>(res.tiles[i].size()));
+
+        if (d->profiles)
+        {
+            const profile& p{ res.profiles->at(i) };
+
+            set_float_array(env, props, block + "_profile_h", p.col.get(), p.width);
+            set_float_array(env, props, block + "_profile_v", p.row.get(), p.height);
+        }
+    }
+}
+
+// Kernel of the instruction set (3: AVX512, 2: AVX2, 1: SSE2, 0: C) for the sample type.
+template <typename T, int range_size>
+static profile_kernel isa_kernel(const int isa, const bool luma) noexcept
+{
+    switch (isa)
+    {
+        case 3: return (luma) ? calculate_profile_luma_avx512<T, range_size> : calculate_profile_avx512<T, range_size>;
+        case 2: return (luma) ? calculate_profile_luma_avx2<T, range_size> : calculate_profile_avx2<T, range_size>;
+        case 1: return (luma) ? calculate_profile_luma_sse2<T, range_size> : calculate_profile_sse2<T, range_size>;
+        default: return (luma) ? calculate_profile_luma<T, range_size> : calculate_profile<T, range_size>;
+    }
+}
+
+template <typename T, int range_size>
+static chroma_kernel isa_chroma_kernel(const int isa) noexcept
+{
+    switch (isa)
+    {
+        case 3: return calculate_profile_uv_avx512<T, range_size>;
+        case 2: return calculate_profile_uv_avx2<T, range_size>;
+        case 1: return calculate_profile_uv_sse2<T, range_size>;
+        default: return calculate_profile_uv<T, range_size>;
+    }
+}
+
+static int select_isa(const int opt, const int iset) noexcept
+{
+    if ((opt == -1 && iset >= 10) || opt == 3)
+        return 3;
+    if ((opt == -1 && iset >= 8) || opt == 2)
+        return 2;
+    if ((opt == -1 && iset >= 2) || opt == 1)
+        return 1;
+
+    return 0;
+}
+
+template <typename T, int range_size>
+static profile_kernel isa_rgba_kernel(const int isa) noexcept
+{
+    switch (isa)
+    {
+        case 3: return calculate_profile_rgba_avx512<T, range_size>;
+        case 2: return calculate_profile_rgba_avx2<T, range_size>;
+        case 1: return calculate_profile_rgba_sse2<T, range_size>;
+        default: return calculate_profile_rgb<T, range_size, 4>;
+    }
+}
+
+static profile_kernel isa_yuy2_kernel(const int isa) noexcept
+{
+    switch (isa)
+    {
+        case 3: return calculate_profile_yuy2_avx512;
+        case 2: return calculate_profile_yuy2_avx2;
+        case 1: return calculate_profile_yuy2_sse2;
+        default: return calculate_profile_yuy2;
+    }
+}
+
+// luma: the kernel computes the luma of planar RGB for AVS_PLANAR_R.
+// RGB24 and RGB48 have only the C++ kernels.
+static profile_kernel select_kernel(const AVS_VideoInfo* vi, const int opt, const int iset, const bool luma = false) noexcept
+{
+    const int isa{ select_isa(opt, iset) };
+
+    if (avs_is_yuy2(vi))
+        return isa_yuy2_kernel(isa);
+    if (avs_is_rgb24(vi))
+        return calculate_profile_rgb<uint8_t, 256, 3>;
+    if (avs_is_rgb32(vi))
+        return isa_rgba_kernel<uint8_t, 256>(isa);
+    if (avs_is_rgb48(vi))
+        return calculate_profile_rgb<uint16_t, 65536, 3>;
+    if (avs_is_rgb64(vi))
+        return isa_rgba_kernel<uint16_t, 65536>(isa);
+
+    switch (avs_component_size(vi))
+    {
+        case 1: return isa_kernel<uint8_t, 256>(isa, luma);
+        case 2:
+        {
+            switch (avs_bits_per_component(vi))
+            {
+                case 10: return isa_kernel<uint16_t, 1024>(isa, luma);
+                case 12: return isa_kernel<uint16_t, 4096>(isa, luma);
+                case 14: return isa_kernel<uint16_t, 16384>(isa, luma);
+                default: return isa_kernel<uint16_t, 65536>(isa, luma);
+            }
+        }
+        default: return isa_kernel<float, 1>(isa, luma);
+    }
+}
+
+// Kernel of U and V of planar YUV when both are processed, nullptr otherwise.
+static chroma_kernel select_chroma_kernel(const AVS_VideoInfo* vi, const bool* process, const int opt, const int iset) noexcept
+{
+    if (!avs_is_yuv(vi) || !avs_is_planar(vi) || avs_num_components(vi) < 3 || !process[1] || !process[2])
+        return nullptr;
+
+    const int isa{ select_isa(opt, iset) };
+
+    switch (avs_component_size(vi))
+    {
+        case 1: return isa_chroma_kernel<uint8_t, 256>(isa);
+        case 2:
+        {
+            switch (avs_bits_per_component(vi))
+            {
+                case 10: return isa_chroma_kernel<uint16_t, 1024>(isa);
+                case 12: return isa_chroma_kernel<uint16_t, 4096>(isa);
+                case 14: return isa_chroma_kernel<uint16_t, 16384>(isa);
+                default: return isa_chroma_kernel<uint16_t, 65536>(isa);
+            }
+        }
+        default: return isa_chroma_kernel<float, 1>(isa);
+    }
+}
+
+// Parse period_min, period_max, opt and planes (planes < 0 when the filter has no such argument).
+// Returns the error prefixed with the name of the filter, an empty string on success.
+static std::string parse_common_args(AVS_Value args, const AVS_VideoInfo* vi, const std::string& name, const int period_min, const int period_max,
+    const int planes, const int opt, common_args& common)
+{
+    common.period_min = avs_defined(avs_array_elt(args, period_min)) ? avs_as_int(avs_array_elt(args, period_min)) : 3;
+    common.period_max = avs_defined(avs_array_elt(args, period_max)) ? avs_as_int(avs_array_elt(args, period_max)) : 24;
+
+    if (common.period_min < 2 || common.period_min > 32)
+        return name + ": period_min must be between 2..32.";
+    if (common.period_max < 2 || common.period_max > 64)
+        return name + ": period_max must be between 2..64.";
+
+    common.opt = avs_defined(avs_array_elt(args, opt)) ? avs_as_int(avs_array_elt(args, opt)) : -1;
+    if (common.opt < -1 || common.opt > 3)
+        return name + ": opt must be between -1..3.";
+
+    common.iset = instrset_detect();
+
+    if (common.opt == 1 && common.iset < 2)
+        return name + ": opt=1 requires SSE2.";
+    if (common.opt == 2 && common.iset < 8)
+        return name + ": opt=2 requires AVX2.";
+    if (common.opt == 3 && common.iset < 10)
+        return name + ": opt=3 requires AVX512F.";
+
+    const int num_planes{ (planes >= 0 && avs_defined(avs_array_elt(args, planes))) ? avs_array_size(avs_array_elt(args, planes)) : 0 };
+
+    for (int i{ 0 }; i < 4; ++i)
+        common.process[i] = (planes >= 0 && num_planes <= 0);
+
+    for (int i{ 0 }; i < num_planes; ++i)
+    {
+        const int n{ avs_as_int(*(avs_as_array(avs_array_elt(args, planes)) + i)) };
+
+        if (n < 0 || n >= avs_num_components(vi))
+            return name + ": plane index out of range";
+
+        if (common.process[n])
+            return name + ": plane specified twice";
+
+        common.process[n] = true;
+    }
+
+    return {};
+}
+
+// Bins of score_sketch per doubling of 1 + score, the relative error of 1 + quantile is below 0.3% (half a bin).
+constexpr float sketch_scale{ 128.0f };
+
+static void add_score(score_sketch& sketch, const float score) noexcept
+{
+    sketch.count.fetch_add(1, std::memory_order_relaxed);
+
+    double sum{ sketch.sum.load(std::memory_order_relaxed) };
+    while (!sketch.sum.compare_exchange_weak(sum, sum + score, std::memory_order_relaxed))
+        ;
+
+    float min{ sketch.min.load(std::memory_order_relaxed) };
+    while (score < min && !sketch.min.compare_exchange_weak(min, score, std::memory_order_relaxed))
+        ;
+
+    float max{ sketch.max.load(std::memory_order_relaxed) };
+    while (score > max && !sketch.max.compare_exchange_weak(max, score, std::memory_order_relaxed))
+        ;
+
+    const int bin{ std::clamp(static_cast<int>(std::log2(1.0f + score) * sketch_scale), 0, static_cast<int>(sketch.bins.size()) - 1) };
+    sketch.bins[bin].fetch_add(1, std::memory_order_relaxed);
+}
+
+// min, mean, p50, p95, p99, max
+static std::array<float, 6> summarize_scores(const score_sketch& sketch) noexcept
+{
+    std::array<uint32_t, std::tuple_size_v<decltype(sketch.bins)>> bins;
+    int64_t total{ 0 };
+
+    for (size_t i{ 0 }; i < bins.size(); ++i)
+    {
+        bins[i] = sketch.bins[i].load(std::memory_order_relaxed);
+        total += bins[i];
+    }
+
+    if (!total)
+        return {};
+
+    const float min{ sketch.min.load(std::memory_order_relaxed) };
+    const float max{ sketch.max.load(std::memory_order_relaxed) };
+    const int64_t count{ sketch.count.load(std::memory_order_relaxed) };
+
+    std::array<float, 6> ret{ min, static_cast<float>(sketch.sum.load(std::memory_order_relaxed) / std::max<int64_t>(count, 1)), 0.0f, 0.0f, 0.0f, max };
+    constexpr float quantiles[]{ 0.5f, 0.95f, 0.99f };
+
+    for (int q{ 0 }; q < 3; ++q)
+    {
+        const int64_t rank{ static_cast<int64_t>(quantiles[q] * (total - 1)) };
+        int64_t cumulative{ 0 };
+        size_t bin{ 0 };
+
+        for (; bin < bins.size() - 1; ++bin)
+        {
+            cumulative += bins[bin];
+
+            if (cumulative > rank)
+                break;
+        }
+
+        // center of the bin
+        ret[q + 2] = std::clamp(std::exp2((bin + 0.5f) / sketch_scale) - 1.0f, min, max);
+    }
+
+    return ret;
+}
+
+static void write_stats(const blockdetect* d, const AVS_VideoInfo* vi)
+{
+    FILE* file{ std::fopen(d->stats_file.c_str(), "w") };
+    if (!file)
+        return;
+
+    std::fputs("{", file);
+    bool first{ true };
+
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        if (!d->process[i])
+            continue;
+
+        const std::array<float, 6> s{ summarize_scores(d->sketches->at(i)) };
+        const std::string block{ plane_name(vi, d, i) };
+
+        std::fprintf(file, "%s\n  \"%s\": { \"frames\": %lld, \"min\": %.6f, \"mean\": %.6f, \"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"max\": %.6f }",
+            (first) ? "" : ",", block.c_str(), static_cast<long long>(d->sketches->at(i).count.load()), s[0], s[1], s[2], s[3], s[4], s[5]);
+        first = false;
+    }
+
+    std::fputs("\n}\n", file);
+    std::fclose(file);
+}
+
+// How many frames wait for a missing preceding frame before the log skips it.
+constexpr size_t log_window{ 256 };
+
+static void push_log(log_writer* log, log_node* node) noexcept
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    log_node* prev{ log->head.exchange(node, std::memory_order_acq_rel) };
+    prev->next.store(node, std::memory_order_release);
+}
+
+// nullptr when the queue is empty or a push isn't finished yet.
+static log_node* pop_log(log_writer* log) noexcept
+{
+    log_node* tail{ log->tail };
+    log_node* next{ tail->next.load(std::memory_order_acquire) };
+
+    if (tail == &log->stub)
+    {
+        if (!next)
+            return nullptr;
+
+        log->tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next)
+    {
+        log->tail = next;
+        return tail;
+    }
+
+    if (tail != log->head.load(std::memory_order_acquire))
+        return nullptr;
+
+    push_log(log, &log->stub);
+    next = tail->next.load(std::memory_order_acquire);
+
+    if (next)
+    {
+        log->tail = next;
+        return tail;
+    }
+
+    return nullptr;
+}
+
+static void log_thread(log_writer* log)
+{
+    // reorder buffer
+    std::map<int, std::array<float, 4>> pending;
+    int next{ 0 };
+    std::string batch;
+
+    while (true)
+    {
+        // everything pushed before stop is drained below
+        const bool stopping{ log->stop.load(std::memory_order_acquire) };
+
+        while (log_node* node{ pop_log(log) })
+        {
+            // a frame requested again, or too late, was written or skipped already
+            if (node->n >= next)
+                pending[node->n] = { node->blockiness[0], node->blockiness[1], node->blockiness[2], node->blockiness[3] };
+
+            delete node;
+        }
+
+        while (!pending.empty() && (pending.begin()->first <= next || pending.size() > log_window || stopping))
+        {
+            const auto it{ pending.begin() };
+            char row[256];
+
+            if (log->jsonl)
+            {
+                batch += "{\"frame\":" + std::to_string(it->first);
+
+                for (const auto& column : log->columns)
+                {
+                    std::snprintf(row, sizeof(row), ",\"%s\":%.6f", column.second.c_str(), it->second[column.first]);
+                    batch += row;
+                }
+
+                batch += "}\n";
+            }
+            else
+            {
+                batch += std::to_string(it->first);
+
+                for (const auto& column : log->columns)
+                {
+                    std::snprintf(row, sizeof(row), ",%.6f", it->second[column.first]);
+                    batch += row;
+                }
+
+                batch += "\n";
+            }
+
+            next = it->first + 1;
+            pending.erase(it);
+        }
+
+        if (!batch.empty())
+        {
+            std::fwrite(batch.data(), 1, batch.size(), log->file);
+            batch.clear();
+        }
+
+        if (stopping)
+            return;
+
+        std::unique_lock<std::mutex> lock(log->mutex);
+        log->cond.wait_for(lock, std::chrono::milliseconds(20));
+    }
+}
+
+log_writer::~log_writer()
+{
+    stop.store(true, std::memory_order_release);
+    cond.notify_all();
+    writer.join();
+    std::fclose(file);
+}
+
+// CSV, or JSONL when the file name ends with .jsonl or .json.
+static std::unique_ptr<log_writer> open_log(const char* path, const blockdetect* d, const AVS_VideoInfo* vi)
+{
+    FILE* file{ std::fopen(path, "w") };
+    if (!file)
+        return nullptr;
+
+    std::unique_ptr<log_writer> log{ std::make_unique<log_writer>() };
+    const std::string name{ path };
+
+    log->file = file;
+    log->jsonl = (name.size() >= 6 && name.compare(name.size() - 6, 6, ".jsonl") == 0) || (name.size() >= 5 && name.compare(name.size() - 5, 5, ".json") == 0);
+    log->stub.next = nullptr;
+    log->head = &log->stub;
+    log->tail = &log->stub;
+    log->stop = false;
+
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        if (d->process[i])
+            log->columns.emplace_back(i, plane_name(vi, d, i));
+    }
+
+    if (!log->jsonl)
+    {
+        std::fputs("frame", file);
+
+        for (const auto& column : log->columns)
+            std::fprintf(file, ",%s", column.second.c_str());
+
+        std::fputs("\n", file);
+    }
+
+    log->writer = std::thread(log_thread, log.get());
+
+    return log;
+}
+
+static std::array<float, 4> plane_scores(const analysis& res) noexcept
+{
+    std::array<float, 4> ret;
+
+    for (int i{ 0 }; i < 4; ++i)
+        ret[i] = std::max(res.planes[i].h.score, res.planes[i].v.score);
+
+    return ret;
+}
+
+static bool load_smooth(const blockdetect* d, const int n, analysis& res)
+{
+    std::lock_guard<std::mutex> lock(d->smoothed->mutex);
+    const std::pair<int, analysis>& entry{ d->smoothed->entries[n % d->smoothed->entries.size()] };
+
+    if (entry.first != n)
+        return false;
+
+    res = entry.second;
+    return true;
+}
+
+static void store_smooth(const blockdetect* d, const int n, const analysis& res)
+{
+    std::lock_guard<std::mutex> lock(d->smoothed->mutex);
+    d->smoothed->entries[n % d->smoothed->entries.size()] = { n, res };
+}
+
+// How many frames are kept for the frames of other picture types.
+constexpr size_t gated_frames{ 16 };
+// How far back a stored frame is searched when the preceding frame isn't stored.
+constexpr int gated_distance{ 32 };
+
+// Frames without _PictType are analyzed.
+static bool selected_pict_type(AVS_ScriptEnvironment* env, const blockdetect* d, AVS_VideoFrame* frame)
+{
+    int err;
+    const char* pict_type{ avs_prop_get_data(env, avs_get_frame_props_ro(env, frame), "_PictType", 0, &err) };
+
+    if (err || !pict_type || !pict_type[0])
+        return true;
+
+    return d->pict_types.find(static_cast<char>(std::toupper(static_cast<unsigned char>(pict_type[0])))) != std::string::npos;
+}
+
+static bool load_gated(const blockdetect* d, const int n, analysis& res, bool& inherited)
+{
+    std::lock_guard<std::mutex> lock(d->gated->mutex);
+    auto it{ d->gated->frames.find(n) };
+
+    if (it == d->gated->frames.end())
+        return false;
+
+    res = it->second.res;
+    inherited = it->second.inherited;
+
+    return true;
+}
+
+// The results of the preceding frame, which carries forward the results of the preceding frame of the selected picture types.
+// Only when the preceding frame isn't stored (for example, after a seek), the frames before it are searched. They are checked to be of the other types,
+// so the results never come from an unrelated part of the clip.
+static bool find_inherited(AVS_FilterInfo* fi, const blockdetect* d, const int n, analysis& res)
+{
+    for (int m{ n - 1 }; m >= std::max(n - gated_distance, 0); --m)
+    {
+        bool inherited;
+
+        if (load_gated(d, m, res, inherited))
+            return true;
+
+        AVS_VideoFrame* frame{ get_child_frame(fi, d, m) };
+        if (!frame)
+            return false;
+
+        const bool selected{ selected_pict_type(fi->env, d, frame) };
+        avs_release_video_frame(frame);
+
+        // the preceding selected frame isn't analyzed yet
+        if (selected)
+            return false;
+    }
+
+    return false;
+}
+
+static void store_gated(const blockdetect* d, const int n, const analysis& res, const bool inherited)
+{
+    std::lock_guard<std::mutex> lock(d->gated->mutex);
+    std::map<int, gated_entry>& frames{ d->gated->frames };
+
+    frames[n] = { res, inherited };
+
+    if (frames.size() > gated_frames)
+    {
+        // drop the frame farthest from the current one
+        if (n - frames.begin()->first > std::prev(frames.end())->first - n)
+            frames.erase(frames.begin());
+        else
+            frames.erase(std::prev(frames.end()));
+    }
+}
+
+// Results of frame n: carried forward (pict_types), cached, repeated (dedup), in the smooth table, or analyzed.
+// The results are stored for the following lookups.
+static analysis frame_results(AVS_FilterInfo* fi, const blockdetect* d, AVS_VideoFrame* frame, const int n, bool& inherited)
+{
+    analysis res;
+    inherited = false;
+
+    // a frame requested again
+    if (d->gated && load_gated(d, n, res, inherited))
+        return res;
+
+    // the other picture types carry forward the results of the preceding selected frame
+    if (d->gated && !selected_pict_type(fi->env, d, frame))
+        inherited = find_inherited(fi, d, n, res);
+
+    if (!inherited && (!d->cache || !load_cached(d, n, res)))
+    {
+        // a frame already in the smooth table is neither hashed nor counted by dedup
+        if (!d->smoothed || !load_smooth(d, n, res))
+        {
+            uint64_t hash{ 0 };
+            bool duplicate{ false };
+
+            if (d->dedup)
+            {
+                hash = hash_frame(frame, d, &fi->vi);
+                duplicate = find_duplicate(d, hash, res);
+
+                if (duplicate)
+                    ++d->dedup->hits;
+                else
+                    ++d->dedup->misses;
+            }
+
+            if (!duplicate)
+                res = (d->prefetched) ? lookahead_blockiness(fi, d, frame, n) : analyze_frame(fi, d, frame, n);
+
+            if (d->dedup && !duplicate)
+                store_duplicate(d, hash, res);
+        }
+
+        if (d->cache)
+            store_cached(d, n, res);
+    }
+
+    // also the inherited results, so the following frames find them in the preceding frame
+    if (d->gated)
+        store_gated(d, n, res, inherited);
+
+    return res;
+}
+
+// Mean and median of the blockiness of frames n - smooth..n + smooth.
+// Every frame is analyzed once while it stays in the table (get_frame_blockdetect looks it up too),
+// so a linear access analyzes one new frame per request. The other frames go through frame_results as the requested ones.
+static void set_smooth_properties(AVS_FilterInfo* fi, const blockdetect* d, const int n, const analysis& res, AVS_Map* props)
+{
+    std::vector<std::array<float, 4>> window;
+
+    for (int m{ std::max(n - d->smooth, 0) }; m < std::min(n + d->smooth + 1, fi->vi.num_frames); ++m)
+    {
+        if (m == n)
+        {
+            store_smooth(d, n, res);
+            window.emplace_back(plane_scores(res));
+            continue;
+        }
+
+        analysis neighbor;
+
+        if (!load_smooth(d, m, neighbor))
+        {
+            AVS_VideoFrame* frame{ get_child_frame(fi, d, m) };
+            if (!frame)
+                continue;
+
+            bool inherited;
+            neighbor = frame_results(fi, d, frame, m, inherited);
+            avs_release_video_frame(frame);
+            store_smooth(d, m, neighbor);
+        }
+
+        window.emplace_back(plane_scores(neighbor));
+    }
+
+    std::vector<float> values(window.size());
+
+    for (int i{ 0 }; i < avs_num_components(&fi->vi); ++i)
+    {
+        if (!d->process[i])
+            continue;
+
+        for (size_t j{ 0 }; j < window.size(); ++j)
+            values[j] = window[j][i];
+
+        const auto middle{ values.begin() + values.size() / 2 };
+        std::nth_element(values.begin(), middle, values.end());
+
+        float sum{ 0.0f };
+        for (const float value : values)
+            sum += value;
+
+        const std::string block{ plane_name(&fi->vi, d, i) };
+
+        avs_prop_set_float(fi->env, props, (block + "_smooth_mean").c_str(), sum / values.size(), 0);
+        avs_prop_set_float(fi->env, props, (block + "_smooth_median").c_str(), *middle, 0);
+    }
+}
+
+static AVS_VideoFrame* AVSC_CC get_frame_blockdetect(AVS_FilterInfo* fi, int n)
+{
+    blockdetect* d{ reinterpret_cast<blockdetect*>(fi->user_data) };
+
+    AVS_VideoFrame* frame{ get_child_frame(fi, d, n) };
+    if (!frame)
+        return nullptr;
+
+    avs_make_property_writable(fi->env, &frame);
+    AVS_Map* props{ avs_get_frame_props_rw(fi->env, frame) };
+
+    bool inherited;
+    const analysis res{ frame_results(fi, d, frame, n, inherited) };
+
+    if (d->dedup)
+    {
+        avs_prop_set_int(fi->env, props, "blockiness_dedup_hits", d->dedup->hits, 0);
+        avs_prop_set_int(fi->env, props, "blockiness_dedup_misses", d->dedup->misses, 0);
+    }
+
+    if (d->gated)
+        avs_prop_set_int(fi->env, props, "blockiness_inherited", inherited, 0);
+
+    set_properties(fi->env, props, d, &fi->vi, res);
+
+    if (d->smoothed)
+        set_smooth_properties(fi, d, n, res, props);
+
+    if (d->sketches)
+    {
+        // a frame requested again is counted once
+        const uint64_t bit{ uint64_t{ 1 } << (n & 63) };
+        const bool first{ !(d->sketched[n / 64].fetch_or(bit) & bit) };
+
+        for (int i{ 0 }; i < avs_num_components(&fi->vi); ++i)
+        {
+            if (!d->process[i])
+                continue;
+
+            if (first)
+                add_score(d->sketches->at(i), std::max(res.planes[i].h.score, res.planes[i].v.score));
+
+            if (d->stats)
+                set_float_array(fi->env, props, plane_name(&fi->vi, d, i) + "_stats", summarize_scores(d->sketches->at(i)).data(), 6);
+        }
+    }
+
+    if (d->log)
+    {
+        log_node* node{ new log_node() };
+        const std::array<float, 4> scores{ plane_scores(res) };
+
+        node->n = n;
+        std::copy(scores.begin(), scores.end(), node->blockiness);
+
+        push_log(d->log.get(), node);
+    }
+
+    return frame;
+}
+
+static void AVSC_CC free_blockdetect(AVS_FilterInfo* fi)
+{
+    blockdetect* d{ reinterpret_cast<blockdetect*>(fi->user_data) };
+
+    if (!d->stats_file.empty())
+        write_stats(d, &fi->vi);
+
+    delete d;
+}
+
+static int AVSC_CC set_cache_hints_blockdetect(AVS_FilterInfo* fi, int cachehints, int frame_range)
+{
+    return cachehints == AVS_CACHE_GET_MTMODE ? 1 : 0;
+}
+
+static AVS_Value AVSC_CC Create_blockdetect(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+{
+    enum { Clip, Period_min, Period_max, Planes, Opt, Luma_grid, Temporal_prior, Pool, Dedup, Incremental, Split, Spectrum, Profiles, Configs, Tiles, Lookahead, Cache, Log, Stats, Stats_file, Smooth, Pict_types, Rgb_mode };
+
+    blockdetect* d{ new blockdetect() };
+
+    AVS_FilterInfo* fi;
+    AVS_Clip* clip{ avs_new_c_filter(env, &fi, avs_array_elt(args, Clip), 1) };
+
+    const auto set_error{ [&](const char* error)
+        {
+            avs_release_clip(clip);
+
+            return avs_new_value_error(error);
+        }
+    };
+
+    if (!avs_check_version(env, 9))
+    {
+        if (avs_check_version(env, 10))
+        {
+            if (avs_get_env_property(env, AVS_AEP_INTERFACE_BUGFIX) < 2)
+                return set_error("BlockDetect: AviSynth+ version must be r3688 or later.");
+        }
+    }
+    else
+        return set_error("BlockDetect: AviSynth+ version must be r3688 or later.");
+
+    common_args common;
+    const std::string error{ parse_common_args(args, &fi->vi, "BlockDetect", Period_min, Period_max, Planes, Opt, common) };
+    if (!error.empty())
+        return set_error(error.c_str());
+
+    // RGB24 and RGB48 have only C++ code
+    if (common.opt > 0 && (avs_is_rgb24(&fi->vi) || avs_is_rgb48(&fi->vi)))
+        return set_error("BlockDetect: opt must be -1 or 0 for RGB24 and RGB48.");
+
+    d->period_min = common.period_min;
+    d->period_max = common.period_max;
+
+    for (int i{ 0 }; i < 4; ++i)
+        d->process[i] = common.process[i];
+
+    if (avs_defined(avs_array_elt(args, Rgb_mode)))
+    {
+        const std::string rgb_mode{ avs_as_string(avs_array_elt(args, Rgb_mode)) };
+
+        if (rgb_mode != "planes" && rgb_mode != "luma")
+            return set_error("BlockDetect: rgb_mode must be \"planes\" or \"luma\".");
+
+        d->rgb_luma = (rgb_mode == "luma");
+
+        if (d->rgb_luma && (!avs_is_rgb(&fi->vi) || !avs_is_planar(&fi->vi)))
+            return set_error("BlockDetect: rgb_mode=\"luma\" requires planar RGB.");
+    }
+
+    // the luma of R, G and B is plane 0
+    if (d->rgb_luma)
+    {
+        d->process[0] = d->process[0] || d->process[1] || d->process[2];
+        d->process[1] = false;
+        d->process[2] = false;
+    }
+
+    d->luma_grid = avs_defined(avs_array_elt(args, Luma_grid)) ? avs_as_bool(avs_array_elt(args, Luma_grid)) : false;
+
+    if (d->luma_grid && avs_is_yuv(&fi->vi) && !d->process[0] && (d->process[1] || d->process[2]))
+        return set_error("BlockDetect: luma_grid requires plane 0 to be processed.");
+
+    d->temporal_prior = avs_defined(avs_array_elt(args, Temporal_prior)) ? avs_as_int(avs_array_elt(args, Temporal_prior)) : 0;
+
+    if (d->temporal_prior < 0)
+        return set_error("BlockDetect: temporal_prior must be greater than or equal to 0.");
+
+    d->pool = avs_defined(avs_array_elt(args, Pool)) ? avs_as_int(avs_array_elt(args, Pool)) : 1;
+
+    if (d->pool < 1)
+        return set_error("BlockDetect: pool must be greater than 0.");
+    if (d->pool > 1 && d->temporal_prior)
+        return set_error("BlockDetect: pool and temporal_prior cannot be used together.");
+
+    if (d->pool > 1)
+        d->pooled = std::make_unique<pool_cache>();
+
+    if (avs_defined(avs_array_elt(args, Dedup)) ? avs_as_bool(avs_array_elt(args, Dedup)) : false)
+    {
+        // the results of a frame are those of its window
+        if (d->pool > 1)
+            return set_error("BlockDetect: pool and dedup cannot be used together.");
+
+        d->dedup = std::make_unique<dedup_cache>();
+    }
+
+    if (avs_defined(avs_array_elt(args, Incremental)) ? avs_as_bool(avs_array_elt(args, Incremental)) : false)
+    {
+        if (d->pool > 1)
+            return set_error("BlockDetect: pool and incremental cannot be used together.");
+        if (!avs_is_planar(&fi->vi) || d->rgb_luma)
+            return set_error("BlockDetect: incremental requires planar format and rgb_mode=\"planes\".");
+
+        d->incremental = std::make_unique<incremental_cache>();
+    }
+
+    d->split = avs_defined(avs_array_elt(args, Split)) ? avs_as_bool(avs_array_elt(args, Split)) : false;
+    d->spectrum = avs_defined(avs_array_elt(args, Spectrum)) ? avs_as_bool(avs_array_elt(args, Spectrum)) : false;
+    d->profiles = avs_defined(avs_array_elt(args, Profiles)) ? avs_as_bool(avs_array_elt(args, Profiles)) : false;
+
+    if (avs_defined(avs_array_elt(args, Configs)))
+    {
+        std::istringstream configs(avs_as_string(avs_array_elt(args, Configs)));
+        std::string config;
+
+        // suffixes of the other frame properties of a plane
+        constexpr std::array<const char*, 12> reserved{ "h", "v", "period_h", "period_v", "spectrum_h", "spectrum_v", "profile_h", "profile_v", "tiles", "stats",
+            "smooth_mean", "smooth_median" };
+
+        while (std::getline(configs, config, ','))
+        {
+            char name[64];
+            int end{ 0 };
+            period_config c;
+
+            if (std::sscanf(config.c_str(), " %63[A-Za-z0-9_] = %d - %d %n", name, &c.period_min, &c.period_max, &end) != 3 || end != static_cast<int>(config.size()))
+                return set_error("BlockDetect: configs must be in the form \"name=period_min-period_max,...\".");
+            if (c.period_min < 2 || c.period_min > 64 || c.period_max < 2 || c.period_max > 64)
+                return set_error("BlockDetect: the periods of configs must be between 2..64.");
+            if (c.period_min > c.period_max)
+                return set_error("BlockDetect: the period_min of configs must be less than or equal to period_max.");
+
+            c.name = name;
+
+            // BlockDetectCompare adds dist1, delta1, ...
+            const std::string base{ c.name.substr(0, c.name.find_last_not_of("0123456789") + 1) };
+
+            if (std::find(reserved.begin(), reserved.end(), c.name) != reserved.end() || base == "dist" || base == "delta")
+                return set_error("BlockDetect: the name of configs is the name of another frame property.");
+
+            for (const period_config& other : d->configs)
+            {
+                if (other.name == c.name)
+                    return set_error("BlockDetect: the name of configs is specified twice.");
+            }
+
+            d->configs.emplace_back(c);
+        }
+    }
+
+    if (avs_defined(avs_array_elt(args, Tiles)))
+    {
+        if (avs_array_size(avs_array_elt(args, Tiles)) != 2)
+            return set_error("BlockDetect: tiles must have two values.");
+
+        d->tiles_x = avs_as_int(*(avs_as_array(avs_array_elt(args, Tiles)) + 0));
+        d->tiles_y = avs_as_int(*(avs_as_array(avs_array_elt(args, Tiles)) + 1));
+
+        if (d->tiles_x < 1 || d->tiles_y < 1)
+            return set_error("BlockDetect: tiles must be greater than 0.");
+
+        // every tile needs at least one column and one row of the smallest processed plane
+        for (int i{ 0 }; i < avs_num_components(&fi->vi); ++i)
+        {
+            if (!d->process[i])
+                continue;
+
+            const int plane{ plane_id(&fi->vi, i) };
+            const int width{ (avs_is_planar(&fi->vi)) ? (fi->vi.width >> avs_get_plane_width_subsampling(&fi->vi, plane))
+                : ((avs_is_yuy2(&fi->vi) && plane != AVS_PLANAR_Y) ? fi->vi.width / 2 : fi->vi.width) };
+            const int height{ (avs_is_planar(&fi->vi)) ? (fi->vi.height >> avs_get_plane_height_subsampling(&fi->vi, plane)) : fi->vi.height };
+
+            if (d->tiles_x > width || d->tiles_y > height)
+                return set_error("BlockDetect: tiles must not be greater than the width and the height of the processed planes.");
+        }
+
+        if (d->pool > 1 || d->incremental)
+            return set_error("BlockDetect: tiles cannot be used together with pool or incremental.");
+    }
+
+    if (d->temporal_prior)
+    {
+        d->temporal = std::make_unique<temporal_slot[]>(temporal_size);
+
+        for (int i{ 0 }; i < temporal_size; ++i)
+        {
+            d->temporal[i].seq = 0;
+            d->temporal[i].words[0] = -1; // temporal_entry::n
+        }
+    }
+
+    d->calculate = select_kernel(&fi->vi, common.opt, common.iset, d->rgb_luma);
+    d->calculate_uv = select_chroma_kernel(&fi->vi, d->process, common.opt, common.iset);
+
+    if (avs_defined(avs_array_elt(args, Cache)))
+    {
+        if (d->spectrum || d->profiles || !d->configs.empty() || d->tiles_x)
+            return set_error("BlockDetect: cache cannot be used together with spectrum, profiles, configs and tiles.");
+
+        d->cache = open_cache(avs_as_string(avs_array_elt(args, Cache)), cache_hash(fi, d), fi->vi.num_frames);
+
+        if (!d->cache)
+            return set_error("BlockDetect: cannot open the cache file.");
+    }
+
+    d->stats = avs_defined(avs_array_elt(args, Stats)) ? avs_as_bool(avs_array_elt(args, Stats)) : false;
+    d->stats_file = avs_defined(avs_array_elt(args, Stats_file)) ? avs_as_string(avs_array_elt(args, Stats_file)) : "";
+
+    if (d->stats || !d->stats_file.empty())
+    {
+        d->sketches = std::make_unique<std::array<score_sketch, 4>>();
+
+        for (score_sketch& sketch : *d->sketches)
+            sketch.min = FLT_MAX;
+
+        const int words{ (fi->vi.num_frames + 63) / 64 };
+        d->sketched = std::make_unique<std::atomic<uint64_t>[]>(words);
+
+        for (int i{ 0 }; i < words; ++i)
+            d->sketched[i] = 0;
+    }
+
+    d->smooth = avs_defined(avs_array_elt(args, Smooth)) ? avs_as_int(avs_array_elt(args, Smooth)) : 0;
+
+    if (d->smooth < 0)
+        return set_error("BlockDetect: smooth must be greater than or equal to 0.");
+
+    if (d->smooth)
+    {
+        // the window of the current frame and of the frames requested in parallel
+        d->smoothed = std::make_unique<smooth_cache>();
+        d->smoothed->entries.resize(4 * static_cast<size_t>(d->smooth) + 4);
+
+        for (std::pair<int, analysis>& entry : d->smoothed->entries)
+            entry.first = -1;
+    }
+
+    if (avs_defined(avs_array_elt(args, Pict_types)))
+    {
+        d->pict_types = avs_as_string(avs_array_elt(args, Pict_types));
+
+        for (char& c : d->pict_types)
+        {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+            if (c != 'I' && c != 'P' && c != 'B')
+                return set_error("BlockDetect: pict_types must consist of I, P and B.");
+        }
+
+        if (d->pict_types.empty())
+            return set_error("BlockDetect: pict_types must consist of I, P and B.");
+
+        d->gated = std::make_unique<gated_cache>();
+    }
+
+    d->lookahead = avs_defined(avs_array_elt(args, Lookahead)) ? avs_as_int(avs_array_elt(args, Lookahead)) : 0;
+
+    if (d->lookahead < 0)
+        return set_error("BlockDetect: lookahead must be greater than or equal to 0.");
+
+    if (avs_defined(avs_array_elt(args, Log)))
+    {
+        d->log = open_log(avs_as_string(avs_array_elt(args, Log)), d, &fi->vi);
+
+        if (!d->log)
+            return set_error("BlockDetect: cannot open the log file.");
+    }
+
+    if (d->lookahead)
+    {
+        d->prefetched = std::make_unique<lookahead_cache>();
+
+        for (int i{ 0 }; i < d->lookahead; ++i)
+            d->prefetched->workers.emplace_back(lookahead_worker, fi, d);
+    }
+
+    AVS_Value v{ avs_new_value_clip(clip) };
+
+    fi->user_data = reinterpret_cast<void*>(d);
+    fi->get_frame = get_frame_blockdetect;
+    fi->set_cache_hints = set_cache_hints_blockdetect;
+    fi->free_filter = free_blockdetect;
+
+    avs_release_clip(clip);
+
+    return v;
+}
+
+static AVS_VideoFrame* AVSC_CC get_frame_blockdetectcompare(AVS_FilterInfo* fi, int n)
+{
+    blockdetectcompare* d{ reinterpret_cast<blockdetectcompare*>(fi->user_data) };
+
+    AVS_VideoFrame* frame{ avs_get_frame(fi->child, n) };
+    if (!frame)
+        return nullptr;
+
+    avs_make_property_writable(fi->env, &frame);
+    AVS_Map* props{ avs_get_frame_props_rw(fi->env, frame) };
+
+    // the reference is analyzed once for all comparisons
+    const analysis ref{ analyze_frame(fi, &d->detect, frame, n) };
+    set_properties(fi->env, props, &d->detect, &fi->vi, ref);
+
+    const std::array<float, 4> ref_scores{ plane_scores(ref) };
+
+    for (size_t k{ 0 }; k < d->dists.size(); ++k)
+    {
+        AVS_VideoFrame* dist{ avs_get_frame(d->dists[k], n) };
+
+        if (!dist)
+        {
+            avs_release_video_frame(frame);
+            return nullptr;
+        }
+
+        const std::array<float, 4> scores{ plane_scores(analyze_frame(fi, &d->detect, dist, n)) };
+        const std::string suffix{ std::to_string(k + 1) };
+
+        avs_release_video_frame(dist);
+
+        for (int i{ 0 }; i < avs_num_components(&fi->vi); ++i)
+        {
+            if (!d->detect.process[i])
+                continue;
+
+            const std::string block{ plane_name(&fi->vi, &d->detect, i) };
+
+            avs_prop_set_float(fi->env, props, (block + "_dist" + suffix).c_str(), scores[i], 0);
+            avs_prop_set_float(fi->env, props, (block + "_delta" + suffix).c_str(), scores[i] - ref_scores[i], 0);
+        }
+    }
+
+    return frame;
+}
+
+static void AVSC_CC free_blockdetectcompare(AVS_FilterInfo* fi)
+{
+    blockdetectcompare* d{ reinterpret_cast<blockdetectcompare*>(fi->user_data) };
+
+    for (AVS_Clip* dist : d->dists)
+        avs_release_clip(dist);
+
+    delete d;
+}
+
+static AVS_Value AVSC_CC Create_blockdetectcompare(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+{
+    enum { Ref, Dists, Period_min, Period_max, Planes, Opt };
+
+    blockdetectcompare* d{ new blockdetectcompare() };
+
+    AVS_FilterInfo* fi;
+    AVS_Clip* clip{ avs_new_c_filter(env, &fi, avs_array_elt(args, Ref), 1) };
+
+    const auto set_error{ [&](const char* error)
+        {
+            for (AVS_Clip* dist : d->dists)
+                avs_release_clip(dist);
+            delete d;
+            avs_release_clip(clip);
+
+            return avs_new_value_error(error);
+        }
+    };
+
+    if (!avs_check_version(env, 9))
+    {
+        if (avs_check_version(env, 10))
+        {
+            if (avs_get_env_property(env, AVS_AEP_INTERFACE_BUGFIX) < 2)
+                return set_error("BlockDetectCompare: AviSynth+ version must be r3688 or later.");
+        }
+    }
+    else
+        return set_error("BlockDetectCompare: AviSynth+ version must be r3688 or later.");
+
+    if (!avs_is_planar(&fi->vi))
+        return set_error("BlockDetectCompare: clip must be in planar format.");
+
+    for (int i{ 0 }; i < avs_array_size(avs_array_elt(args, Dists)); ++i)
+    {
+        d->dists.emplace_back(avs_take_clip(*(avs_as_array(avs_array_elt(args, Dists)) + i), env));
+        const AVS_VideoInfo* vi{ avs_get_video_info(d->dists.back()) };
+
+        if (vi->width != fi->vi.width || vi->height != fi->vi.height || !avs_is_same_colorspace(vi, &fi->vi))
+            return set_error("BlockDetectCompare: all clips must have the same dimensions and format.");
+    }
+
+    blockdetect& detect{ d->detect };
+
+    common_args common;
+    const std::string error{ parse_common_args(args, &fi->vi, "BlockDetectCompare", Period_min, Period_max, Planes, Opt, common) };
+    if (!error.empty())
+        return set_error(error.c_str());
+
+    detect.period_min = common.period_min;
+    detect.period_max = common.period_max;
+
+    for (int i{ 0 }; i < 4; ++i)
+        detect.process[i] = common.process[i];
+
+    detect.pool = 1;
+    detect.calculate = select_kernel(&fi->vi, common.opt, common.iset);
+    detect.calculate_uv = select_chroma_kernel(&fi->vi, detect.process, common.opt, common.iset);
+
+    AVS_Value v{ avs_new_value_clip(clip) };
+
+    fi->user_data = reinterpret_cast<void*>(d);
+    fi->get_frame = get_frame_blockdetectcompare;
+    fi->set_cache_hints = set_cache_hints_blockdetect;
+    fi->free_filter = free_blockdetectcompare;
+
+    avs_release_clip(clip);
+
+    return v;
+}
+
+// How many preceding frames decide the frames between the thresholds of BlockDetectSwitch.
+constexpr int switch_range{ 8 };
+
+static bool cached_score(blockdetectswitch* d, const int n, float& score)
+{
+    std::lock_guard<std::mutex> lock(d->scores->mutex);
+    const std::pair<int, float>& entry{ d->scores->entries[n % d->scores->entries.size()] };
+
+    if (entry.first != n)
+        return false;
+
+    score = entry.second;
+    return true;
+}
+
+static float frame_score(AVS_FilterInfo* fi, blockdetectswitch* d, AVS_VideoFrame* frame, const int n)
+{
+    const analysis res{ analyze_frame(fi, &d->detect, frame, n) };
+    const blockiness& plane{ res.planes[d->plane] };
+    const float score{ std::max(plane.h.score, plane.v.score) };
+
+    std::lock_guard<std::mutex> lock(d->scores->mutex);
+    d->scores->entries[n % d->scores->entries.size()] = { n, score };
+
+    return score;
+}
+
+static AVS_VideoFrame* AVSC_CC get_frame_blockdetectswitch(AVS_FilterInfo* fi, int n)
+{
+    blockdetectswitch* d{ reinterpret_cast<blockdetectswitch*>(fi->user_data) };
+
+    AVS_VideoFrame* src{ avs_get_frame(fi->child, n) };
+    if (!src)
+        return nullptr;
+
+    // The frames between the thresholds keep the decision of the preceding frames.
+    // Walking back instead of remembering the last decision gives the same result in any frame order.
+    bool switched{ false };
+
+    for (int m{ n }; m >= std::max(n - switch_range, 0); --m)
+    {
+        float score;
+
+        if (!cached_score(d, m, score))
+        {
+            AVS_VideoFrame* frame{ (m == n) ? src : avs_get_frame(fi->child, m) };
+            if (!frame)
+                break;
+
+            score = frame_score(fi, d, frame, m);
+
+            if (m != n)
+                avs_release_video_frame(frame);
+        }
+
+        if (score >= d->threshold)
+        {
+            switched = true;
+            break;
+        }
+
+        if (score < d->threshold - d->hysteresis)
+            break;
+    }
+
+    if (!switched)
+        return src;
+
+    avs_release_video_frame(src);
+
+    return avs_get_frame(d->alt, n);
+}
+
+static void AVSC_CC free_blockdetectswitch(AVS_FilterInfo* fi)
+{
+    blockdetectswitch* d{ reinterpret_cast<blockdetectswitch*>(fi->user_data) };
+
+    avs_release_clip(d->alt);
+    delete d;
+}
+
+static AVS_Value AVSC_CC Create_blockdetectswitch(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+{
+    enum { Src, Alt, Threshold, Hysteresis, Plane, Period_min, Period_max, Opt };
+
+    blockdetectswitch* d{ new blockdetectswitch() };
+
+    AVS_FilterInfo* fi;
+    AVS_Clip* clip{ avs_new_c_filter(env, &fi, avs_array_elt(args, Src), 1) };
+
+    const auto set_error{ [&](const char* error)
+        {
+            if (d->alt)
+                avs_release_clip(d->alt);
+            delete d;
+            avs_release_clip(clip);
+
+            return avs_new_value_error(error);
+        }
+    };
+
+    if (!avs_check_version(env, 9))
+    {
+        if (avs_check_version(env, 10))
+        {
+            if (avs_get_env_property(env, AVS_AEP_INTERFACE_BUGFIX) < 2)
+                return set_error("BlockDetectSwitch: AviSynth+ version must be r3688 or later.");
+        }
+    }
+    else
+        return set_error("BlockDetectSwitch: AviSynth+ version must be r3688 or later.");
+
+    if (!avs_is_planar(&fi->vi))
+        return set_error("BlockDetectSwitch: clip must be in planar format.");
+
+    d->alt = avs_take_clip(avs_array_elt(args, Alt), env);
+    const AVS_VideoInfo* vi_alt{ avs_get_video_info(d->alt) };
+
+    if (vi_alt->width != fi->vi.width || vi_alt->height != fi->vi.height || !avs_is_same_colorspace(vi_alt, &fi->vi))
+        return set_error("BlockDetectSwitch: src and alt must have the same dimensions and format.");
+
+    d->threshold = static_cast<float>(avs_as_float(avs_array_elt(args, Threshold)));
+    d->hysteresis = avs_defined(avs_array_elt(args, Hysteresis)) ? static_cast<float>(avs_as_float(avs_array_elt(args, Hysteresis))) : 0.0f;
+
+    if (d->hysteresis < 0.0f)
+        return set_error("BlockDetectSwitch: hysteresis must be greater than or equal to 0.0.");
+
+    d->plane = avs_defined(avs_array_elt(args, Plane)) ? avs_as_int(avs_array_elt(args, Plane)) : 0;
+
+    if (d->plane < 0 || d->plane >= avs_num_components(&fi->vi))
+        return set_error("BlockDetectSwitch: plane index out of range");
+
+    blockdetect& detect{ d->detect };
+
+    common_args common;
+    const std::string error{ parse_common_args(args, &fi->vi, "BlockDetectSwitch", Period_min, Period_max, -1, Opt, common) };
+    if (!error.empty())
+        return set_error(error.c_str());
+
+    detect.period_min = common.period_min;
+    detect.period_max = common.period_max;
+
+    detect.process[d->plane] = true;
+    detect.pool = 1;
+    detect.calculate = select_kernel(&fi->vi, common.opt, common.iset);
+    detect.calculate_uv = select_chroma_kernel(&fi->vi, detect.process, common.opt, common.iset);
+
+    d->scores = std::make_unique<score_cache>();
+
+    for (std::pair<int, float>& entry : d->scores->entries)
+        entry.first = -1;
+
+    AVS_Value v{ avs_new_value_clip(clip) };
+
+    fi->user_data = reinterpret_cast<void*>(d);
+    fi->get_frame = get_frame_blockdetectswitch;
+    fi->set_cache_hints = set_cache_hints_blockdetect;
+    fi->free_filter = free_blockdetectswitch;
+
+    avs_release_clip(clip);
+
+    return v;
+}
+
+// Boundary strength of every cell of the detected grid mapped to 0..1.
+// The grid is found in the profiles of the whole plane, the cells are scored in the profiles of their rows and columns of cells.
+static void block_mask(AVS_VideoFrame* frame, const blockdetectmask* d, const int plane, const int width, const int height, float* mask)
+{
+    std::unique_ptr<float[]> col{ std::make_unique<float[]>(width) };
+    std::unique_ptr<float[]> row{ std::make_unique<float[]>(height) };
+
+    d->calculate(frame, plane, 0, width, 0, height, col.get(), row.get());
+
+    // without a grid the direction is a single cell
+    int period_h{ find_period(col.get(), 3, width - 4, d->period_min, d->period_max).period };
+    int period_v{ find_period(row.get(), 3, height - 4, d->period_min, d->period_max).period };
+
+    if (!period_h)
+        period_h = width;
+    if (!period_v)
+        period_v = height;
+
+    std::vector<int> xs;
+    std::vector<int> ys;
+
+    for (int x{ 0 }; x < width; x += period_h)
+        xs.emplace_back(x);
+    for (int y{ 0 }; y < height; y += period_v)
+        ys.emplace_back(y);
+
+    xs.emplace_back(width);
+    ys.emplace_back(height);
+
+    std::unique_ptr<float[]> cols{ std::make_unique<float[]>((ys.size() - 1) * width) };
+    std::unique_ptr<float[]> rows{ std::make_unique<float[]>((xs.size() - 1) * height) };
+
+    accumulate_tiles(frame, d->calculate, plane, width, height, xs, ys, cols.get(), rows.get());
+
+    const auto level{ [&](const float ratio)
+        {
+            return std::clamp((ratio - 1.0f) / (d->max_ratio - 1.0f), 0.0f, 1.0f);
+        }
+    };
+
+    for (size_t ty{ 0 }; ty + 1 < ys.size(); ++ty)
+    {
+        const int y0{ ys[ty] };
+        const int y1{ ys[ty + 1] };
+
+        for (size_t tx{ 0 }; tx + 1 < xs.size(); ++tx)
+        {
+            const int x0{ xs[tx] };
+            const int x1{ xs[tx + 1] };
+
+            // the right edge of the cell is the only block of its period in the cell
+            const float h{ level(period_score(cols.get() + ty * width, std::max(x0, 3), std::min(x1, width - 4), period_h)) };
+            // the bottom edge
+            const float v{ level(period_score(rows.get() + tx * height, std::max(y0, 3), std::min(y1, height - 4), period_v)) };
+
+            if (d->edges)
+            {
+                // the pixels on both sides of the edges
+                for (int y{ y0 }; y < y1; ++y)
+                {
+                    for (int x{ x1 - 1 }; x < std::min(x1 + 1, width); ++x)
+                        mask[y * width + x] = std::max(mask[y * width + x], h);
+                }
+
+                for (int y{ y1 - 1 }; y < std::min(y1 + 1, height); ++y)
+                {
+                    for (int x{ x0 }; x < x1; ++x)
+                        mask[y * width + x] = std::max(mask[y * width + x], v);
+                }
+            }
+            else
+            {
+                for (int y{ y0 }; y < y1; ++y)
+                    std::fill(mask + y * width + x0, mask + y * width + x1, std::max(h, v));
+            }
+        }
+    }
+}
+
+template <typename T>
+static void store_mask(AVS_VideoFrame* frame, const int plane, const float* mask, const float peak) noexcept
+{
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, plane) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, plane) / static_cast<int>(sizeof(T)) };
+    const int height{ avs_get_height_p(frame, plane) };
+    T* dstp{ reinterpret_cast<T*>(avs_get_write_ptr_p(frame, plane)) };
+
+    for (int y{ 0 }; y < height; ++y)
+    {
+        for (int x{ 0 }; x < width; ++x)
+        {
+            if constexpr (std::is_same_v<T, float>)
+                dstp[x] = mask[y * width + x] * peak;
+            else
+                dstp[x] = static_cast<T>(mask[y * width + x] * peak + 0.5f);
+        }
+
+        dstp += pitch;
+    }
+}
+
+static AVS_VideoFrame* AVSC_CC get_frame_blockdetectmask(AVS_FilterInfo* fi, int n)
+{
+    blockdetectmask* d{ reinterpret_cast<blockdetectmask*>(fi->user_data) };
+
+    AVS_VideoFrame* src{ avs_get_frame(fi->child, n) };
+    if (!src)
+        return nullptr;
+
+    AVS_VideoFrame* dst{ avs_new_video_frame_p(fi->env, &fi->vi, src) };
+
+    for (int i{ 0 }; i < avs_num_components(&fi->vi); ++i)
+    {
+        const int plane{ plane_id(&fi->vi, i) };
+        const int width{ avs_get_row_size_p(src, plane) / avs_component_size(&fi->vi) };
+        const int height{ avs_get_height_p(src, plane) };
+
+        std::unique_ptr<float[]> mask{ std::make_unique<float[]>(static_cast<size_t>(width) * height) };
+
+        if (d->process[i])
+            block_mask(src, d, plane, width, height, mask.get());
+
+        d->store(dst, plane, mask.get(), d->peak);
+    }
+
+    avs_release_video_frame(src);
+
+    return dst;
+}
+
+static void AVSC_CC free_blockdetectmask(AVS_FilterInfo* fi)
+{
+    blockdetectmask* d{ reinterpret_cast<blockdetectmask*>(fi->user_data) };
+    delete d;
+}
+
+static AVS_Value AVSC_CC Create_blockdetectmask(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+{
+    enum { Clip, Period_min, Period_max, Planes, Opt, Edges, Max_ratio };
+
+    blockdetectmask* d{ new blockdetectmask() };
+
+    AVS_FilterInfo* fi;
+    AVS_Clip* clip{ avs_new_c_filter(env, &fi, avs_array_elt(args, Clip), 1) };
+
+    const auto set_error{ [&](const char* error)
+        {
+            delete d;
+            avs_release_clip(clip);
+
+            return avs_new_value_error(error);
+        }
+    };
+
+    if (!avs_check_version(env, 9))
+    {
+        if (avs_check_version(env, 10))
+        {
+            if (avs_get_env_property(env, AVS_AEP_INTERFACE_BUGFIX) < 2)
+                return set_error("BlockDetectMask: AviSynth+ version must be r3688 or later.");
+        }
+    }
+    else
+        return set_error("BlockDetectMask: AviSynth+ version must be r3688 or later.");
+
+    if (!avs_is_planar(&fi->vi))
+        return set_error("BlockDetectMask: clip must be in planar format.");
+
+    common_args common;
+    const std::string error{ parse_common_args(args, &fi->vi, "BlockDetectMask", Period_min, Period_max, Planes, Opt, common) };
+    if (!error.empty())
+        return set_error(error.c_str());
+
+    d->period_min = common.period_min;
+    d->period_max = common.period_max;
+
+    for (int i{ 0 }; i < 4; ++i)
+        d->process[i] = common.process[i];
+
+    d->edges = avs_defined(avs_array_elt(args, Edges)) ? avs_as_bool(avs_array_elt(args, Edges)) : false;
+    d->max_ratio = avs_defined(avs_array_elt(args, Max_ratio)) ? static_cast<float>(avs_as_float(avs_array_elt(args, Max_ratio))) : 3.0f;
+
+    if (d->max_ratio <= 1.0f)
+        return set_error("BlockDetectMask: max_ratio must be greater than 1.0.");
+
+    d->calculate = select_kernel(&fi->vi, common.opt, common.iset);
+
+    switch (avs_component_size(&fi->vi))
+    {
+        case 1: d->store = store_mask<uint8_t>; break;
+        case 2: d->store = store_mask<uint16_t>; break;
+        default: d->store = store_mask<float>;
+    }
+
+    d->peak = (avs_component_size(&fi->vi) < 4) ? static_cast<float>((1 << avs_bits_per_component(&fi->vi)) - 1) : 1.0f;
+
+    AVS_Value v{ avs_new_value_clip(clip) };
+
+    fi->user_data = reinterpret_cast<void*>(d);
+    fi->get_frame = get_frame_blockdetectmask;
+    fi->set_cache_hints = set_cache_hints_blockdetect;
+    fi->free_filter = free_blockdetectmask;
+
+    avs_release_clip(clip);
+
+    return v;
+}
+
+static AVS_Value AVSC_CC Create_blockdetectscore(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+{
+    enum { Clip, Period_min, Period_max, Periods, Plane };
+
+    const AVS_Value cn{ avs_get_var(env, "current_frame") };
+    if (!avs_is_int(cn))
+        return avs_new_value_error("BlockDetectScore: this function can only be used within run-time filters.");
+
+    AVS_Clip* clip{ avs_take_clip(avs_array_elt(args, Clip), env) };
+    const AVS_VideoInfo* vi{ avs_get_video_info(clip) };
+
+    const auto set_error{ [&](const char* error)
+        {
+            avs_release_clip(clip);
+
+            return avs_new_value_error(error);
+        }
+    };
+
+    const int plane{ avs_defined(avs_array_elt(args, Plane)) ? avs_as_int(avs_array_elt(args, Plane)) : 0 };
+    if (plane < 0 || plane >= avs_num_components(vi))
+        return set_error("BlockDetectScore: plane index out of range");
+
+    std::vector<int> periods;
+
+    if (avs_defined(avs_array_elt(args, Periods)))
+    {
+        for (int i{ 0 }; i < avs_array_size(avs_array_elt(args, Periods)); ++i)
+            periods.emplace_back(avs_as_int(*(avs_as_array(avs_array_elt(args, Periods)) + i)));
+    }
+    else
+    {
+        const int period_min{ avs_defined(avs_array_elt(args, Period_min)) ? avs_as_int(avs_array_elt(args, Period_min)) : 3 };
+        const int period_max{ avs_defined(avs_array_elt(args, Period_max)) ? avs_as_int(avs_array_elt(args, Period_max)) : 24 };
+
+        for (int period{ period_min }; period < period_max + 1; ++period)
+            periods.emplace_back(period);
+    }
+
+    for (const int period : periods)
+    {
+        if (period < 2)
+            return set_error("BlockDetectScore: periods must be greater than 1.");
+    }
+
+    AVS_VideoFrame* frame{ avs_get_frame(clip, avs_as_int(cn)) };
+    if (!frame)
+        return set_error("BlockDetectScore: failed to get the frame.");
+
+    const AVS_Map* props{ avs_get_frame_props_ro(env, frame) };
+
+    const std::string block{ plane_name(vi, nullptr, plane) };
+
+    float ret{ 0.0f };
+
+    for (const char* direction : { "_profile_h", "_profile_v" })
+    {
+        const std::string key{ block + direction };
+        const int size{ avs_prop_num_elements(env, props, key.c_str()) };
+        int err;
+        const double* values{ avs_prop_get_float_array(env, props, key.c_str(), &err) };
+
+        if (size < 1 || err)
+        {
+            avs_release_video_frame(frame);
+            return set_error("BlockDetectScore: the frame has no profiles, use BlockDetect(profiles=true).");
+        }
+
+        const std::vector<float> profile(values, values + size);
+
+        for (const int period : periods)
+            ret = std::max(ret, period_score(profile.data(), 3, size - 4, period));
+    }
+
+    avs_release_video_frame(frame);
+    avs_release_clip(clip);
+
+    return avs_new_value_float(ret);
+}
+
+static AVS_Value AVSC_CC Create_blockdetectvalue(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+{
+    enum { Clip, Plane, Period_min, Period_max, Opt };
+
+    const AVS_Value cn{ avs_get_var(env, "current_frame") };
+    if (!avs_is_int(cn))
+        return avs_new_value_error("BlockDetectValue: this function can only be used within run-time filters.");
+
+    AVS_Clip* clip{ avs_take_clip(avs_array_elt(args, Clip), env) };
+    const AVS_VideoInfo* vi{ avs_get_video_info(clip) };
+
+    const auto set_error{ [&](const char* error)
+        {
+            avs_release_clip(clip);
+
+            return avs_new_value_error(error);
+        }
+    };
+
+    if (!avs_is_planar(vi))
+        return set_error("BlockDetectValue: clip must be in planar format.");
+
+    const int plane{ avs_defined(avs_array_elt(args, Plane)) ? avs_as_int(avs_array_elt(args, Plane)) : 0 };
+    if (plane < 0 || plane >= avs_num_components(vi))
+        return set_error("BlockDetectValue: plane index out of range");
+
+    common_args common;
+    const std::string error{ parse_common_args(args, vi, "BlockDetectValue", Period_min, Period_max, -1, Opt, common) };
+    if (!error.empty())
+        return set_error(error.c_str());
+
+    const int period_min{ common.period_min };
+    const int period_max{ common.period_max };
+
+    // The run-time script is evaluated for every frame, so the kernel and the profiles are kept between the calls.
+    thread_local value_state state{ -1, -1, nullptr };
+
+    if (!state.calculate || state.pixel_type != vi->pixel_type || state.opt != common.opt)
+    {
+        state.pixel_type = vi->pixel_type;
+        state.opt = common.opt;
+        state.calculate = select_kernel(vi, common.opt, common.iset);
+    }
+
+    AVS_VideoFrame* frame{ avs_get_frame(clip, avs_as_int(cn)) };
+    if (!frame)
+        return set_error("BlockDetectValue: failed to get the frame.");
+
+    const int id{ plane_id(vi, plane) };
+    const int width{ avs_get_row_size_p(frame, id) / avs_component_size(vi) };
+    const int height{ avs_get_height_p(frame, id) };
+
+    state.col.assign(width, 0.0f);
+    state.row.assign(height, 0.0f);
+    state.calculate(frame, id, 0, width, 0, height, state.col.data(), state.row.data());
+
+    avs_release_video_frame(frame);
+    avs_release_clip(clip);
+
+    return avs_new_value_float(std::max(find_period(state.col.data(), 3, width - 4, period_min, period_max).score,
+        find_period(state.row.data(), 3, height - 4, period_min, period_max).score));
+}
+
+// A zone shorter than min_length joins the preceding one.
+static void close_zone(std::vector<zone>& zones, const zone& z, const int min_length)
+{
+    if (!zones.empty() && (z.last - z.first + 1 < min_length || zones.back().blocky == z.blocky))
+        zones.back().last = z.last;
+    else
+        zones.emplace_back(z);
+}
+
+// ConditionalReader file of a bool variable that is true in the blocky zones.
+static bool write_conditional_zones(const char* path, const std::vector<zone>& zones)
+{
+    FILE* file{ std::fopen(path, "w") };
+    if (!file)
+        return false;
+
+    std::fputs("Type bool\nDefault false\n\n", file);
+
+    for (const zone& z : zones)
+    {
+        if (z.blocky)
+            std::fprintf(file, "R %d %d true\n", z.first, z.last);
+    }
+
+    return !std::fclose(file);
+}
+
+// Value of the --zones option of x264/x265 for the blocky zones.
+static bool write_encoder_zones(const char* path, const std::vector<zone>& zones, const std::string& options)
+{
+    FILE* file{ std::fopen(path, "w") };
+    if (!file)
+        return false;
+
+    bool first{ true };
+
+    for (const zone& z : zones)
+    {
+        if (!z.blocky)
+            continue;
+
+        std::fprintf(file, "%s%d,%d,%s", (first) ? "" : "/", z.first, z.last, options.c_str());
+        first = false;
+    }
+
+    std::fputs("\n", file);
+
+    return !std::fclose(file);
+}
+
+static AVS_Value AVSC_CC Create_blockdetectscan(AVS_ScriptEnvironment* env, AVS_Value args, void* param)
+{
+    enum { Clip, File, Threads, Range, Period_min, Period_max, Planes, Opt, Threshold, Hysteresis, Min_length, Conditional_file, Zones_file, Zones_options };
+
+    AVS_Clip* clip{ avs_take_clip(avs_array_elt(args, Clip), env) };
+    const AVS_VideoInfo* vi{ avs_get_video_info(clip) };
+
+    const auto set_error{ [&](const char* error)
+        {
+            avs_release_clip(clip);
+
+            return avs_new_value_error(error);
+        }
+    };
+
+    if (!avs_is_planar(vi))
+        return set_error("BlockDetectScan: clip must be in planar format.");
+
+    blockdetect d{};
+    d.pool = 1;
+    common_args common;
+    const std::string error{ parse_common_args(args, vi, "BlockDetectScan", Period_min, Period_max, Planes, Opt, common) };
+    if (!error.empty())
+        return set_error(error.c_str());
+
+    d.period_min = common.period_min;
+    d.period_max = common.period_max;
+
+    for (int i{ 0 }; i < 4; ++i)
+        d.process[i] = common.process[i];
+
+    d.calculate = select_kernel(vi, common.opt, common.iset);
+    d.calculate_uv = select_chroma_kernel(vi, d.process, common.opt, common.iset);
+
+    const int threads{ avs_defined(avs_array_elt(args, Threads)) ? avs_as_int(avs_array_elt(args, Threads)) : 1 };
+
+    if (threads < 1)
+        return set_error("BlockDetectScan: threads must be greater than 0.");
+
+    int first{ 0 };
+    int last{ vi->num_frames - 1 };
+
+    if (avs_defined(avs_array_elt(args, Range)))
+    {
+        if (avs_array_size(avs_array_elt(args, Range)) != 2)
+            return set_error("BlockDetectScan: range must have two values.");
+
+        first = avs_as_int(*(avs_as_array(avs_array_elt(args, Range)) + 0));
+        last = avs_as_int(*(avs_as_array(avs_array_elt(args, Range)) + 1));
+
+        if (first < 0 || last >= vi->num_frames || first > last)
+            return set_error("BlockDetectScan: range must be [first, last] within the clip.");
+    }
+
+    const bool segment{ avs_defined(avs_array_elt(args, Threshold)) != 0 };
+    const float threshold{ segment ? static_cast<float>(avs_as_float(avs_array_elt(args, Threshold))) : 0.0f };
+    const float hysteresis{ avs_defined(avs_array_elt(args, Hysteresis)) ? static_cast<float>(avs_as_float(avs_array_elt(args, Hysteresis))) : 0.0f };
+    const int min_length{ avs_defined(avs_array_elt(args, Min_length)) ? avs_as_int(avs_array_elt(args, Min_length)) : 1 };
+    const char* conditional_file{ avs_defined(avs_array_elt(args, Conditional_file)) ? avs_as_string(avs_array_elt(args, Conditional_file)) : nullptr };
+    const char* zones_file{ avs_defined(avs_array_elt(args, Zones_file)) ? avs_as_string(avs_array_elt(args, Zones_file)) : nullptr };
+    const std::string zones_options{ avs_defined(avs_array_elt(args, Zones_options)) ? avs_as_string(avs_array_elt(args, Zones_options)) : "b=1.5" };
+
+    if (hysteresis < 0.0f)
+        return set_error("BlockDetectScan: hysteresis must be greater than or equal to 0.0.");
+    if (min_length < 1)
+        return set_error("BlockDetectScan: min_length must be greater than 0.");
+    if (!segment && (conditional_file || zones_file))
+        return set_error("BlockDetectScan: conditional_file and zones_file require threshold.");
+
+    FILE* file{ std::fopen(avs_as_string(avs_array_elt(args, File)), "wb") };
+    if (!file)
+        return set_error("BlockDetectScan: cannot open the output file.");
+
+    // The workers analyze at most window frames ahead of the last written one.
+    const int window{ threads * 4 };
+    std::vector<scan_record> ring(window);
+    std::vector<bool> ready(window);
+    std::mutex mutex;
+    std::condition_variable cond;
+    // the workers aren't AviSynth threads, the frames are requested one at a time
+    std::mutex fetch;
+    int next{ first };
+    int written{ first };
+    bool failed{ false };
+
+    const auto worker{ [&]()
+        {
+            while (true)
+            {
+                int n;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [&]() { return failed || next > last || next < written + window; });
+
+                    if (failed || next > last)
+                        return;
+
+                    n = next++;
+                }
+
+                AVS_VideoFrame* frame;
+
+                {
+                    std::lock_guard<std::mutex> lock(fetch);
+                    frame = avs_get_frame(clip, n);
+                }
+
+                if (!frame)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    failed = true;
+                    cond.notify_all();
+                    return;
+                }
+
+                std::array<profile, 4> profiles;
+                accumulate_profiles(frame, &d, vi, profiles);
+                const std::array<blockiness, 4> planes{ search_profiles(&d, vi, profiles, n, nullptr, nullptr) };
+
+                avs_release_video_frame(frame);
+
+                scan_record record{ n, {} };
+
+                for (int i{ 0 }; i < 4; ++i)
+                    record.blockiness[i] = std::max(planes[i].h.score, planes[i].v.score);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                ring[n % window] = record;
+                ready[n % window] = true;
+                cond.notify_all();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+
+    for (int i{ 0 }; i < threads; ++i)
+        pool.emplace_back(worker);
+
+    float min[4]{ FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+    float max[4]{};
+    double sum[4]{};
+
+    // the frames are blocky from threshold up, and stay blocky down to threshold - hysteresis
+    std::vector<zone> zones;
+    zone current{ first, first - 1, false };
+
+    // write the records in frame order
+    while (written <= last)
+    {
+        scan_record record;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() { return failed || ready[written % window]; });
+
+            if (failed)
+                break;
+
+            record = ring[written % window];
+            ready[written % window] = false;
+            ++written;
+            cond.notify_all();
+        }
+
+        if (std::fwrite(&record, sizeof(record), 1, file) != 1)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+            cond.notify_all();
+            break;
+        }
+
+        for (int i{ 0 }; i < 4; ++i)
+        {
+            min[i] = std::min(min[i], record.blockiness[i]);
+            max[i] = std::max(max[i], record.blockiness[i]);
+            sum[i] += record.blockiness[i];
+        }
+
+        if (segment)
+        {
+            float score{ 0.0f };
+
+            for (int i{ 0 }; i < 4; ++i)
+            {
+                if (d.process[i])
+                    score = std::max(score, record.blockiness[i]);
+            }
+
+            const bool blocky{ score >= threshold || (current.blocky && score >= threshold - hysteresis) };
+
+            if (record.n == first)
+                current = { record.n, record.n, blocky };
+            else if (blocky == current.blocky)
+                current.last = record.n;
+            else
+            {
+                close_zone(zones, current, min_length);
+                current = { record.n, record.n, blocky };
+            }
+        }
+    }
+
+    for (std::thread& t : pool)
+        t.join();
+
+    std::fclose(file);
+
+    if (failed)
+        return set_error("BlockDetectScan: failed to get a frame or to write the output file.");
+
+    if (segment)
+    {
+        close_zone(zones, current, min_length);
+
+        if (conditional_file && !write_conditional_zones(conditional_file, zones))
+            return set_error("BlockDetectScan: cannot write conditional_file.");
+        if (zones_file && !write_encoder_zones(zones_file, zones, zones_options))
+            return set_error("BlockDetectScan: cannot write zones_file.");
+    }
+
+    const std::array<char, 4> names_y{ 'y', 'u', 'v', 'a' };
+    const std::array<char, 4> names_r{ 'r', 'g', 'b', 'a' };
+    const std::array<char, 4>& names{ (avs_is_rgb(vi)) ? names_r : names_y };
+
+    std::ostringstream summary;
+    summary << "frames=" << last - first + 1;
+
+    for (int i{ 0 }; i < avs_num_components(vi); ++i)
+    {
+        if (d.process[i])
+            summary << " " << names[i] << ": min=" << min[i] << " mean=" << sum[i] / (last - first + 1) << " max=" << max[i];
+    }
+
+    if (segment)
+        summary << " zones=" << std::count_if(zones.begin(), zones.end(), [](const zone& z) { return z.blocky; });
+
+    avs_release_clip(clip);
+
+    const std::string ret{ summary.str() };
+
+    return avs_new_value_string(avs_save_string(env, ret.c_str(), static_cast<int>(ret.size())));
 }
 
 const char* AVSC_CC avisynth_c_plugin_init(AVS_ScriptEnvironment* env)
 {
-    avs_add_function(env, "BlockDetect", "c[period_min]i[period_max]i[planes]i*[opt]i", Create_blockdetect, 0);
+    avs_add_function(env, "BlockDetect", "c[period_min]i[period_max]i[planes]i*[opt]i[luma_grid]b[temporal_prior]i[pool]i[dedup]b[incremental]b[split]b[spectrum]b[profiles]b[configs]s[tiles]i*[lookahead]i[cache]s[log]s[stats]b[stats_file]s[smooth]i[pict_types]s[rgb_mode]s", Create_blockdetect, 0);
+    avs_add_function(env, "BlockDetectCompare", "cc+[period_min]i[period_max]i[planes]i*[opt]i", Create_blockdetectcompare, 0);
+    avs_add_function(env, "BlockDetectSwitch", "ccf[hysteresis]f[plane]i[period_min]i[period_max]i[opt]i", Create_blockdetectswitch, 0);
+    avs_add_function(env, "BlockDetectMask", "c[period_min]i[period_max]i[planes]i*[opt]i[edges]b[max_ratio]f", Create_blockdetectmask, 0);
+    avs_add_function(env, "BlockDetectScore", "c[period_min]i[period_max]i[periods]i*[plane]i", Create_blockdetectscore, 0);
+    avs_add_function(env, "BlockDetectValue", "c[plane]i[period_min]i[period_max]i[opt]i", Create_blockdetectvalue, 0);
+    avs_add_function(env, "BlockDetectScan", "cs[threads]i[range]i*[period_min]i[period_max]i[planes]i*[opt]i[threshold]f[hysteresis]f[min_length]i[conditional_file]s[zones_file]s[zones_options]s", Create_blockdetectscan, 0);
     return "BlockDetect";
 }
@@ -1,22 +1,434 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "avisynth_c.h"
 
+struct grid
+{
+    float score;
+    int period;
+};
+
+struct blockiness
+{
+    grid h;
+    grid v;
+    // block/nonblock ratio of every period from period_min, when requested
+    float spectrum_h[63];
+    float spectrum_v[63];
+};
+
+// Accumulated normalized gradients: col per column (horizontal), row per row (vertical).
+struct profile
+{
+    std::unique_ptr<float[]> col;
+    std::unique_ptr<float[]> row;
+    int width;
+    int height;
+};
+
+// Results of all planes of a frame.
+struct analysis
+{
+    std::array<blockiness, 4> planes;
+    // the searched profiles, when requested
+    std::shared_ptr<const std::array<profile, 4>> profiles;
+    // highest value of horz||vert of every period configuration
+    std::vector<std::array<float, 4>> configs;
+    // highest value of horz||vert of every tile, row by row
+    std::array<std::vector<float>, 4> tiles;
+};
+
+// Results of the pooled windows, by window index.
+struct pool_cache
+{
+    std::mutex mutex;
+    std::map<int, std::shared_future<analysis>> windows;
+};
+
+// Winning period of one direction and the profile folded modulo that period.
+struct temporal_grid
+{
+    int searched; // frame of the last full period search
+    int period;
+    float fold[64];
+};
+
+struct temporal_entry
+{
+    int n;
+    temporal_grid grid[4][2];
+};
+
+// Seqlock protected copy of a temporal_entry.
+struct temporal_slot
+{
+    std::atomic<unsigned> seq;
+    std::atomic<int> words[sizeof(temporal_entry) / sizeof(int)];
+};
+
+struct dedup_entry
+{
+    uint64_t hash;
+    bool valid;
+    analysis res;
+};
+
+// Results of the recently processed frames, by content hash.
+struct dedup_cache
+{
+    std::mutex mutex;
+    std::array<dedup_entry, 16> entries;
+    size_t next;
+    std::atomic<int64_t> hits;
+    std::atomic<int64_t> misses;
+};
+
+// Band profiles of the previous frame.
+struct incremental_plane
+{
+    std::unique_ptr<float[]> bands; // horizontal profile of every band of rows
+    std::unique_ptr<float[]> row;
+};
+
+struct incremental_state
+{
+    int n;
+    AVS_VideoFrame* frame;
+    incremental_plane planes[4];
+
+    ~incremental_state()
+    {
+        if (frame)
+            avs_release_video_frame(frame);
+    }
+};
+
+struct incremental_cache
+{
+    std::mutex mutex;
+    std::unique_ptr<incremental_state> state;
+};
+
+// Add the profiles of columns [x0, x1) and rows [y0, y1).
+using profile_kernel = void (*)(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+
+// Add the profiles of columns [x0, x1) and rows [y0, y1) of the U and the V plane.
+using chroma_kernel = void (*)(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v,
+    float* row_v) noexcept;
+
+// Frames analyzed ahead of the requests, by frame number, and the frames waiting for a worker.
+struct lookahead_cache
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::map<int, std::shared_future<analysis>> frames;
+    std::deque<std::pair<int, std::promise<analysis>>> jobs;
+    std::vector<std::thread> workers;
+    std::mutex fetch; // held while a frame of the child is requested
+    bool stop;
+
+    ~lookahead_cache()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+
+        cond.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+};
+
+struct cache_header
+{
+    char magic[8];
+    uint64_t hash; // format, parameters and source
+    int32_t num_frames;
+    int32_t record_size;
+};
+
+// Results of a frame in the cache file, valid is set after the results are written.
+struct cache_record
+{
+    std::atomic<uint32_t> valid;
+    grid planes[4][2];
+};
+
+// Memory mapped cache file: cache_header followed by a cache_record for every frame.
+struct result_cache
+{
+    void* view;
+    size_t size;
+    cache_header* header;
+    cache_record* records;
+    std::mutex mutex;
+
+    ~result_cache();
+};
+
+struct log_node
+{
+    std::atomic<log_node*> next;
+    int n;
+    float blockiness[4];
+};
+
+// Log file of the results. The frames push their rows to a lock-free MPSC queue (intrusive, with a stub node),
+// the writer thread puts them in frame order and writes them in batches.
+struct log_writer
+{
+    std::atomic<log_node*> head;
+    log_node* tail; // used only by the writer thread
+    log_node stub;
+    FILE* file;
+    bool jsonl;
+    std::vector<std::pair<int, std::string>> columns; // plane index, name
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<bool> stop;
+    std::thread writer;
+
+    ~log_writer();
+};
+
+// Streaming summary of the scores of a plane: exact count, sum, min and max,
+// and a histogram with logarithmic bins for the quantiles.
+struct score_sketch
+{
+    std::atomic<int64_t> count;
+    std::atomic<double> sum;
+    std::atomic<float> min;
+    std::atomic<float> max;
+    std::array<std::atomic<uint32_t>, 1024> bins;
+};
+
+// Results of the frames around the requested ones, by frame number modulo the size.
+struct smooth_cache
+{
+    std::mutex mutex;
+    std::vector<std::pair<int, analysis>> entries;
+};
+
+struct gated_entry
+{
+    analysis res;
+    bool inherited; // carried forward from the preceding frame
+};
+
+// Results of the recently requested frames of BlockDetect with pict_types, by frame number.
+struct gated_cache
+{
+    std::mutex mutex;
+    std::map<int, gated_entry> frames;
+};
+
+struct period_config
+{
+    std::string name;
+    int period_min;
+    int period_max;
+};
+
 struct blockdetect
 {
     int period_min;
     int period_max;
     bool process[4];
+    bool rgb_luma; // planar RGB analyzed as one luma plane (plane 0)
+    bool luma_grid;
+    int temporal_prior;
+    std::unique_ptr<temporal_slot[]> temporal;
+    int pool;
+    std::unique_ptr<pool_cache> pooled;
+    std::unique_ptr<dedup_cache> dedup;
+    std::unique_ptr<incremental_cache> incremental;
+    bool split;
+    bool spectrum;
+    bool profiles;
+    std::vector<period_config> configs;
+    int tiles_x;
+    int tiles_y;
+    profile_kernel calculate;
+    chroma_kernel calculate_uv; // U and V in one pass, when both are processed
+    std::unique_ptr<result_cache> cache;
+    std::unique_ptr<log_writer> log;
+    bool stats;
+    std::string stats_file;
+    std::unique_ptr<std::array<score_sketch, 4>> sketches;
+    std::unique_ptr<std::atomic<uint64_t>[]> sketched; // one bit per frame, set when the frame is added to sketches
+    int smooth;
+    std::unique_ptr<smooth_cache> smoothed;
+    std::string pict_types;
+    std::unique_ptr<gated_cache> gated;
+    int lookahead;
+    // last, the workers use the other members until they are joined
+    std::unique_ptr<lookahead_cache> prefetched;
+};
+
+// Scores of the recently analyzed frames, by frame number.
+struct score_cache
+{
+    std::mutex mutex;
+    std::array<std::pair<int, float>, 32> entries;
+};
+
+struct blockdetectswitch
+{
+    blockdetect detect;
+    AVS_Clip* alt;
+    int plane;
+    float threshold;
+    float hysteresis;
+    std::unique_ptr<score_cache> scores;
+};
+
+// Kernel and profiles of BlockDetectValue, reused by the following calls of the same thread.
+struct value_state
+{
+    int pixel_type;
+    int opt;
+    profile_kernel calculate;
+    std::vector<float> col;
+    std::vector<float> row;
+};
+
+// Record of BlockDetectScan: frame number and blockiness of every plane (0 when not processed).
+struct scan_record
+{
+    int32_t n;
+    float blockiness[4];
+};
+
+// Range of frames of BlockDetectScan that are all blocky or all not.
+struct zone
+{
+    int first;
+    int last;
+    bool blocky;
+};
+
+// Arguments shared by the filters: period_min, period_max, opt and planes.
+struct common_args
+{
+    int period_min;
+    int period_max;
+    int opt;
+    int iset;
+    bool process[4];
+};
 
-    const float (*calculate)(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
+struct blockdetectcompare
+{
+    blockdetect detect;
+    std::vector<AVS_Clip*> dists;
 };
 
+struct blockdetectmask
+{
+    int period_min;
+    int period_max;
+    bool process[4];
+    bool edges;
+    float max_ratio;
+    float peak;
+    profile_kernel calculate;
+    // Write the 0..1 mask of a plane scaled to peak.
+    void (*store)(AVS_VideoFrame* frame, const int plane, const float* mask, const float peak) noexcept;
+};
+
+// Normalized gradient between s[0] and s[step] according to (1)(2).
+template <typename T, int range_size>
+inline float normalized_gradient(const T* s, const ptrdiff_t step) noexcept
+{
+    float temp{ 0.0f };
+    float grad = std::abs(s[0] - s[step]);
+    temp += std::abs(s[1 * step] - s[2 * step]);
+    temp += std::abs(s[2 * step] - s[3 * step]);
+    temp += std::abs(s[3 * step] - s[4 * step]);
+    temp += std::abs(s[0] - s[-1 * step]);
+    temp += std::abs(s[-1 * step] - s[-2 * step]);
+    temp += std::abs(s[-2 * step] - s[-3 * step]);
+
+    if (temp)
+        grad /= temp;
+    else
+        grad /= range_size;
+
+    return grad;
+}
+
+// BT.601 weights of the luma of RGB.
+constexpr float luma_r{ 0.299f };
+constexpr float luma_g{ 0.587f };
+constexpr float luma_b{ 0.114f };
+
+// normalized_gradient of the luma of r/g/b, which have the same pitch.
+template <typename T, int range_size>
+inline float normalized_gradient_luma(const T* r, const T* g, const T* b, const ptrdiff_t step) noexcept
+{
+    auto l{ [&](const ptrdiff_t i) noexcept { return luma_r * r[i * step] + luma_g * g[i * step] + luma_b * b[i * step]; } };
+
+    float temp{ 0.0f };
+    float grad = std::abs(l(0) - l(1));
+    temp += std::abs(l(1) - l(2));
+    temp += std::abs(l(2) - l(3));
+    temp += std::abs(l(3) - l(4));
+    temp += std::abs(l(0) - l(-1));
+    temp += std::abs(l(-1) - l(-2));
+    temp += std::abs(l(-2) - l(-3));
+
+    if (temp)
+        grad /= temp;
+    else
+        grad /= range_size;
+
+    return grad;
+}
+
+template <typename T, int range_size>
+void calculate_profile_sse2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template <typename T, int range_size>
+void calculate_profile_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template <typename T, int range_size>
+void calculate_profile_avx512(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template <typename T, int range_size>
+void calculate_profile_luma_sse2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template <typename T, int range_size>
+void calculate_profile_luma_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template <typename T, int range_size>
+void calculate_profile_luma_avx512(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template <typename T, int range_size>
+void calculate_profile_uv_sse2(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+template <typename T, int range_size>
+void calculate_profile_uv_avx2(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+template <typename T, int range_size>
+void calculate_profile_uv_avx512(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+void calculate_profile_yuy2_sse2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+void calculate_profile_yuy2_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+void calculate_profile_yuy2_avx512(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
 template <typename T, int range_size>
-const float calculate_blockiness_sse2(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
+void calculate_profile_rgba_sse2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
 template <typename T, int range_size>
-const float calculate_blockiness_avx2(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
+void calculate_profile_rgba_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
 template <typename T, int range_size>
-const float calculate_blockiness_avx512(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
+void calculate_profile_rgba_avx512(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
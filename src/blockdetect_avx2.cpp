@@ -1,443 +1,349 @@
 #include "blockdetect.h"
 #include "VCL2/vectorclass.h"
 
+template <typename T>
+static inline Vec8f load(const T* srcp) noexcept
+{
+    if constexpr (std::is_same_v<T, uint8_t>)
+        return to_float(Vec8i().load_8uc(srcp));
+    else if constexpr (std::is_same_v<T, uint16_t>)
+        return to_float(Vec8i().load_8us(srcp));
+    else
+        return Vec8f().load(srcp);
+}
+
 template <typename T, int range_size>
-const float calculate_blockiness_avx2(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept
+static inline Vec8f normalized_gradient_avx2(const T* s, const ptrdiff_t step) noexcept
 {
-    const size_t pitch{ avs_get_pitch_p(frame, plane) / sizeof(T) };
-    const size_t width{ avs_get_row_size_p(frame, plane) / sizeof(T) };
+    const Vec8f m3{ load(s - 3 * step) };
+    const Vec8f m2{ load(s - 2 * step) };
+    const Vec8f m1{ load(s - 1 * step) };
+    const Vec8f p0{ load(s) };
+    const Vec8f p1{ load(s + 1 * step) };
+    const Vec8f p2{ load(s + 2 * step) };
+    const Vec8f p3{ load(s + 3 * step) };
+    const Vec8f p4{ load(s + 4 * step) };
+
+    const Vec8f grad{ abs(p0 - p1) };
+    Vec8f temp{ abs(p1 - p2) };
+    temp += abs(p2 - p3);
+    temp += abs(p3 - p4);
+    temp += abs(p0 - m1);
+    temp += abs(m1 - m2);
+    temp += abs(m2 - m3);
+
+    return select(temp > 0.0f, grad / temp, grad / range_size);
+}
+
+template <typename T, int range_size>
+void calculate_profile_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, plane) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, plane) / static_cast<int>(sizeof(T)) };
     const int height{ avs_get_height_p(frame, plane) };
     const T* srcp{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, plane)) };
 
-    std::unique_ptr<float[]> grad{ std::make_unique<float[]>(width * height) };
-    float ret{ 0 };
+    // Calculate BS in horizontal and vertical directions according to (1)(2)(3).
+    // Also try to find integer pixel periods (grids) even for scaled images.
+    // In case of fractional periods, FFMAX of current and neighbor pixels
+    // can help improve the correlation with MQS.
+    // Skip linear correction term (4)(5), as it appears only valid for their own test samples.
 
-    if constexpr (std::is_same_v<T, uint8_t>)
+    // horizontal blockiness (fixed width)
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
     {
-        // Calculate BS in horizontal and vertical directions according to (1)(2)(3).
-        // Also try to find integer pixel periods (grids) even for scaled images.
-        // In case of fractional periods, FFMAX of current and neighbor pixels
-        // can help improve the correlation with MQS.
-        // Skip linear correction term (4)(5), as it appears only valid for their own test samples.
-
-        // horizontal blockiness (fixed width)
-        for (int y{ 1 }; y < height; ++y)
-        {
-            for (int x{ 3 }; x < width - 4; x += 32)
-            {
-                Vec8i temp0{ zero_si256() };
-                Vec8i temp1{ zero_si256() };
-                Vec8i temp2{ zero_si256() };
-                Vec8i temp3{ zero_si256() };
-
-                auto grad_temp0{ to_float(abs(Vec8i().load_8uc(&srcp[y * pitch + x + 0]) - Vec8i().load_8uc(&srcp[y * pitch + x + 1]))) };
-                temp0 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 1]) - Vec8i().load_8uc(&srcp[y * pitch + x + 2]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 2]) - Vec8i().load_8uc(&srcp[y * pitch + x + 3]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 3]) - Vec8i().load_8uc(&srcp[y * pitch + x + 4]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[y * pitch + x - 0]) - Vec8i().load_8uc(&srcp[y * pitch + x - 1]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[y * pitch + x - 1]) - Vec8i().load_8uc(&srcp[y * pitch + x - 2]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[y * pitch + x - 2]) - Vec8i().load_8uc(&srcp[y * pitch + x - 3]));
-                grad_temp0 = select(temp0 > 0, grad_temp0 / to_float(temp0), grad_temp0 / range_size);
-
-                auto grad_temp1{ to_float(abs(Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 0]) - Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 1]))) };
-                temp1 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 1]) - Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 2]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 2]) - Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 3]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 3]) - Vec8i().load_8uc(&srcp[y * pitch + x + 8 + 4]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 8 - 0]) - Vec8i().load_8uc(&srcp[y * pitch + x + 8 - 1]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 8 - 1]) - Vec8i().load_8uc(&srcp[y * pitch + x + 8 - 2]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 8 - 2]) - Vec8i().load_8uc(&srcp[y * pitch + x + 8 - 3]));
-                grad_temp1 = select(temp1 > 0, grad_temp1 / to_float(temp1), grad_temp1 / range_size);
-
-                auto grad_temp2{ to_float(abs(Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 0]) - Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 1]))) };
-                temp2 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 1]) - Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 2]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 2]) - Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 3]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 3]) - Vec8i().load_8uc(&srcp[y * pitch + x + 16 + 4]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 16 - 0]) - Vec8i().load_8uc(&srcp[y * pitch + x + 16 - 1]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 16 - 1]) - Vec8i().load_8uc(&srcp[y * pitch + x + 16 - 2]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 16 - 2]) - Vec8i().load_8uc(&srcp[y * pitch + x + 16 - 3]));
-                grad_temp2 = select(temp2 > 0, grad_temp2 / to_float(temp2), grad_temp2 / range_size);
-
-                auto grad_temp3{ to_float(abs(Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 0]) - Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 1]))) };
-                temp3 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 1]) - Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 2]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 2]) - Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 3]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 3]) - Vec8i().load_8uc(&srcp[y * pitch + x + 24 + 4]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 24 - 0]) - Vec8i().load_8uc(&srcp[y * pitch + x + 24 - 1]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 24 - 1]) - Vec8i().load_8uc(&srcp[y * pitch + x + 24 - 2]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[y * pitch + x + 24 - 2]) - Vec8i().load_8uc(&srcp[y * pitch + x + 24 - 3]));
-                grad_temp3 = select(temp3 > 0, grad_temp3 / to_float(temp3), grad_temp3 / range_size);
-
-                // use first row to store acculated results
-                (Vec8f().load(&grad[x]) + grad_temp0).store(&grad[x]);
-                (Vec8f().load(&grad[x + 8]) + grad_temp1).store(&grad[x + 8]);
-                (Vec8f().load(&grad[x + 16]) + grad_temp2).store(&grad[x + 16]);
-                (Vec8f().load(&grad[x + 24]) + grad_temp3).store(&grad[x + 24]);
-            }
-        }
+        const T* s{ srcp + y * pitch };
+        const int end{ std::min(x1, width - 4) };
+        int x{ std::max(x0, 3) };
 
-        // find horizontal period
-        for (int period{ d->period_min }; period < d->period_max + 1; ++period)
-        {
-            float temp;
-            float block{ 0.0f };
-            float nonblock{ 0.0f };
-            int block_count{ 0 };
-            int nonblock_count{ 0 };
-
-            for (int x{ 3 }; x < width - 4; ++x)
-            {
-                if ((x % period) == (period - 1))
-                {
-                    block += std::max(std::max(grad[x + 0], grad[x + 1]), grad[x - 1]);
-                    block_count++;
-                }
-                else
-                {
-                    nonblock += grad[x];
-                    nonblock_count++;
-                }
-            }
-
-            if (block_count && nonblock_count && nonblock)
-            {
-                temp = (block / block_count) / (nonblock / nonblock_count);
-                ret = std::max(ret, temp);
-            }
-        }
+        // use col to store accumulated results
+        for (; x + 8 <= end; x += 8)
+            (Vec8f().load(col + x) + normalized_gradient_avx2<T, range_size>(s + x, 1)).store(col + x);
 
-        // vertical blockiness (fixed height)
-        for (int y{ 3 }; y < height - 4; ++y)
-        {
-            for (int x{ 1 }; x < width; x += 32)
-            {
-                Vec8i temp0{ zero_si256() };
-                Vec8i temp1{ zero_si256() };
-                Vec8i temp2{ zero_si256() };
-                Vec8i temp3{ zero_si256() };
-
-                auto grad_temp0{ to_float(abs(Vec8i().load_8uc(&srcp[(y + 0) * pitch + x]) - Vec8i().load_8uc(&srcp[(y + 1) * pitch + x]))) };
-                temp0 += abs(Vec8i().load_8uc(&srcp[(y + 1) * pitch + x]) - Vec8i().load_8uc(&srcp[(y + 2) * pitch + x]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[(y + 2) * pitch + x]) - Vec8i().load_8uc(&srcp[(y + 3) * pitch + x]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[(y + 3) * pitch + x]) - Vec8i().load_8uc(&srcp[(y + 4) * pitch + x]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[(y - 0) * pitch + x]) - Vec8i().load_8uc(&srcp[(y - 1) * pitch + x]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[(y - 1) * pitch + x]) - Vec8i().load_8uc(&srcp[(y - 2) * pitch + x]));
-                temp0 += abs(Vec8i().load_8uc(&srcp[(y - 2) * pitch + x]) - Vec8i().load_8uc(&srcp[(y - 3) * pitch + x]));
-                grad_temp0 = select(temp0 > 0, grad_temp0 / to_float(temp0), grad_temp0 / range_size);
-
-                auto grad_temp1{ to_float(abs(Vec8i().load_8uc(&srcp[(y + 0) * pitch + x + 8]) - Vec8i().load_8uc(&srcp[(y + 1) * pitch + x + 8]))) };
-                temp1 += abs(Vec8i().load_8uc(&srcp[(y + 1) * pitch + x + 8]) - Vec8i().load_8uc(&srcp[(y + 2) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[(y + 2) * pitch + x + 8]) - Vec8i().load_8uc(&srcp[(y + 3) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[(y + 3) * pitch + x + 8]) - Vec8i().load_8uc(&srcp[(y + 4) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[(y - 0) * pitch + x + 8]) - Vec8i().load_8uc(&srcp[(y - 1) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[(y - 1) * pitch + x + 8]) - Vec8i().load_8uc(&srcp[(y - 2) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8uc(&srcp[(y - 2) * pitch + x + 8]) - Vec8i().load_8uc(&srcp[(y - 3) * pitch + x + 8]));
-                grad_temp1 = select(temp1 > 0, grad_temp1 / to_float(temp1), grad_temp1 / range_size);
-
-                auto grad_temp2{ to_float(abs(Vec8i().load_8uc(&srcp[(y + 0) * pitch + x + 16]) - Vec8i().load_8uc(&srcp[(y + 1) * pitch + x + 16]))) };
-                temp2 += abs(Vec8i().load_8uc(&srcp[(y + 1) * pitch + x + 16]) - Vec8i().load_8uc(&srcp[(y + 2) * pitch + x + 16]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[(y + 2) * pitch + x + 16]) - Vec8i().load_8uc(&srcp[(y + 3) * pitch + x + 16]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[(y + 3) * pitch + x + 16]) - Vec8i().load_8uc(&srcp[(y + 4) * pitch + x + 16]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[(y - 0) * pitch + x + 16]) - Vec8i().load_8uc(&srcp[(y - 1) * pitch + x + 16]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[(y - 1) * pitch + x + 16]) - Vec8i().load_8uc(&srcp[(y - 2) * pitch + x + 16]));
-                temp2 += abs(Vec8i().load_8uc(&srcp[(y - 2) * pitch + x + 16]) - Vec8i().load_8uc(&srcp[(y - 3) * pitch + x + 16]));
-                grad_temp2 = select(temp2 > 0, grad_temp2 / to_float(temp2), grad_temp2 / range_size);
-
-                auto grad_temp3{ to_float(abs(Vec8i().load_8uc(&srcp[(y + 0) * pitch + x + 24]) - Vec8i().load_8uc(&srcp[(y + 1) * pitch + x + 24]))) };
-                temp3 += abs(Vec8i().load_8uc(&srcp[(y + 1) * pitch + x + 24]) - Vec8i().load_8uc(&srcp[(y + 2) * pitch + x + 24]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[(y + 2) * pitch + x + 24]) - Vec8i().load_8uc(&srcp[(y + 3) * pitch + x + 24]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[(y + 3) * pitch + x + 24]) - Vec8i().load_8uc(&srcp[(y + 4) * pitch + x + 24]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[(y - 0) * pitch + x + 24]) - Vec8i().load_8uc(&srcp[(y - 1) * pitch + x + 24]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[(y - 1) * pitch + x + 24]) - Vec8i().load_8uc(&srcp[(y - 2) * pitch + x + 24]));
-                temp3 += abs(Vec8i().load_8uc(&srcp[(y - 2) * pitch + x + 24]) - Vec8i().load_8uc(&srcp[(y - 3) * pitch + x + 24]));
-                grad_temp3 = select(temp3 > 0, grad_temp3 / to_float(temp3), grad_temp3 / range_size);
-
-                // use first column to store accumulated results
-                (Vec8f().load(&grad[y * width]) + grad_temp0).store(&grad[y * width]);
-                (Vec8f().load(&grad[y * width]) + grad_temp1).store(&grad[y * width]);
-                (Vec8f().load(&grad[y * width]) + grad_temp2).store(&grad[y * width]);
-                (Vec8f().load(&grad[y * width]) + grad_temp3).store(&grad[y * width]);
-            }
-        }
+        for (; x < end; ++x)
+            col[x] += normalized_gradient<T, range_size>(s + x, 1);
+    }
 
-        // find vertical period
-        for (int period{ d->period_min }; period < d->period_max + 1; ++period)
-        {
-            float temp;
-            float block{ 0.0f };
-            float nonblock{ 0.0f };
-            int block_count{ 0 };
-            int nonblock_count{ 0 };
-
-            for (int y{ 3 }; y < height - 4; y++)
-            {
-                if ((y % period) == (period - 1))
-                {
-                    block += std::max(std::max(grad[(y + 0) * width], grad[(y + 1) * width]), grad[(y - 1) * width]);
-                    block_count++;
-                }
-                else
-                {
-                    nonblock += grad[y * width];
-                    nonblock_count++;
-                }
-            }
-
-            if (block_count && nonblock_count && nonblock)
-            {
-                temp = (block / block_count) / (nonblock / nonblock_count);
-                ret = std::max(ret, temp);
-            }
-        }
+    // vertical blockiness (fixed height)
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
+    {
+        const T* s{ srcp + y * pitch };
+        Vec8f sum{ zero_8f() };
+        const int end{ std::min(x1, width) };
+        int x{ std::max(x0, 1) };
+
+        for (; x + 8 <= end; x += 8)
+            sum += normalized_gradient_avx2<T, range_size>(s + x, pitch);
+
+        // use row to store accumulated results
+        row[y] += horizontal_add(sum);
+
+        for (; x < end; ++x)
+            row[y] += normalized_gradient<T, range_size>(s + x, pitch);
     }
-    else if constexpr (std::is_same_v<T, uint16_t>)
+}
+
+template void calculate_profile_avx2<uint8_t, 256>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_avx2<uint16_t, 1024>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_avx2<uint16_t, 4096>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_avx2<uint16_t, 16384>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_avx2<uint16_t, 65536>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_avx2<float, 1>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+
+template <typename T, int range_size>
+static inline Vec8f normalized_gradient_luma_avx2(const T* r, const T* g, const T* b, const ptrdiff_t step) noexcept
+{
+    auto l{ [&](const ptrdiff_t i) noexcept { return mul_add(load(r + i * step), luma_r, mul_add(load(g + i * step), luma_g, load(b + i * step) * luma_b)); } };
+
+    const Vec8f m3{ l(-3) };
+    const Vec8f m2{ l(-2) };
+    const Vec8f m1{ l(-1) };
+    const Vec8f p0{ l(0) };
+    const Vec8f p1{ l(1) };
+    const Vec8f p2{ l(2) };
+    const Vec8f p3{ l(3) };
+    const Vec8f p4{ l(4) };
+
+    const Vec8f grad{ abs(p0 - p1) };
+    Vec8f temp{ abs(p1 - p2) };
+    temp += abs(p2 - p3);
+    temp += abs(p3 - p4);
+    temp += abs(p0 - m1);
+    temp += abs(m1 - m2);
+    temp += abs(m2 - m3);
+
+    return select(temp > 0.0f, grad / temp, grad / range_size);
+}
+
+// Profiles of the luma of the R, G and B planes when plane is AVS_PLANAR_R, of the plane otherwise.
+template <typename T, int range_size>
+void calculate_profile_luma_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    if (plane != AVS_PLANAR_R)
+        return calculate_profile_avx2<T, range_size>(frame, plane, x0, x1, y0, y1, col, row);
+
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, AVS_PLANAR_G) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, AVS_PLANAR_G) / static_cast<int>(sizeof(T)) };
+    const int height{ avs_get_height_p(frame, AVS_PLANAR_G) };
+    const T* srcp_r{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_R)) };
+    const T* srcp_g{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_G)) };
+    const T* srcp_b{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_B)) };
+
+    // horizontal blockiness (fixed width)
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
+    {
+        const T* r{ srcp_r + y * pitch };
+        const T* g{ srcp_g + y * pitch };
+        const T* b{ srcp_b + y * pitch };
+        const int end{ std::min(x1, width - 4) };
+        int x{ std::max(x0, 3) };
+
+        for (; x + 8 <= end; x += 8)
+            (Vec8f().load(col + x) + normalized_gradient_luma_avx2<T, range_size>(r + x, g + x, b + x, 1)).store(col + x);
+
+        for (; x < end; ++x)
+            col[x] += normalized_gradient_luma<T, range_size>(r + x, g + x, b + x, 1);
+    }
+
+    // vertical blockiness (fixed height)
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
     {
-        // Calculate BS in horizontal and vertical directions according to (1)(2)(3).
-        // Also try to find integer pixel periods (grids) even for scaled images.
-        // In case of fractional periods, FFMAX of current and neighbor pixels
-        // can help improve the correlation with MQS.
-        // Skip linear correction term (4)(5), as it appears only valid for their own test samples.
-
-        // horizontal blockiness (fixed width)
-        for (int y{ 1 }; y < height; ++y)
+        const T* r{ srcp_r + y * pitch };
+        const T* g{ srcp_g + y * pitch };
+        const T* b{ srcp_b + y * pitch };
+        Vec8f sum{ zero_8f() };
+        const int end{ std::min(x1, width) };
+        int x{ std::max(x0, 1) };
+
+        for (; x + 8 <= end; x += 8)
+            sum += normalized_gradient_luma_avx2<T, range_size>(r + x, g + x, b + x, pitch);
+
+        row[y] += horizontal_add(sum);
+
+        for (; x < end; ++x)
+            row[y] += normalized_gradient_luma<T, range_size>(r + x, g + x, b + x, pitch);
+    }
+}
+
+template void calculate_profile_luma_avx2<uint8_t, 256>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_luma_avx2<uint16_t, 1024>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_luma_avx2<uint16_t, 4096>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_luma_avx2<uint16_t, 16384>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_luma_avx2<uint16_t, 65536>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_luma_avx2<float, 1>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+
+// U and V have the same geometry, their rows are walked together with separate accumulators.
+template <typename T, int range_size>
+void calculate_profile_uv_avx2(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept
+{
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, AVS_PLANAR_U) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, AVS_PLANAR_U) / static_cast<int>(sizeof(T)) };
+    const int height{ avs_get_height_p(frame, AVS_PLANAR_U) };
+    const T* srcp_u{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_U)) };
+    const T* srcp_v{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_PLANAR_V)) };
+
+    // horizontal blockiness (fixed width)
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
+    {
+        const T* u{ srcp_u + y * pitch };
+        const T* v{ srcp_v + y * pitch };
+        const int end{ std::min(x1, width - 4) };
+        int x{ std::max(x0, 3) };
+
+        for (; x + 8 <= end; x += 8)
         {
-            for (int x{ 3 }; x < width - 4; x += 16)
-            {
-                Vec8i temp0{ zero_si256() };
-                Vec8i temp1{ zero_si256() };
-
-                auto grad_temp0{ to_float(abs(Vec8i().load_8us(&srcp[y * pitch + x + 0]) - Vec8i().load_8us(&srcp[y * pitch + x + 1]))) };
-                temp0 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 1]) - Vec8i().load_8us(&srcp[y * pitch + x + 2]));
-                temp0 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 2]) - Vec8i().load_8us(&srcp[y * pitch + x + 3]));
-                temp0 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 3]) - Vec8i().load_8us(&srcp[y * pitch + x + 4]));
-                temp0 += abs(Vec8i().load_8us(&srcp[y * pitch + x - 0]) - Vec8i().load_8us(&srcp[y * pitch + x - 1]));
-                temp0 += abs(Vec8i().load_8us(&srcp[y * pitch + x - 1]) - Vec8i().load_8us(&srcp[y * pitch + x - 2]));
-                temp0 += abs(Vec8i().load_8us(&srcp[y * pitch + x - 2]) - Vec8i().load_8us(&srcp[y * pitch + x - 3]));
-                grad_temp0 = select(temp0 > 0, grad_temp0 / to_float(temp0), grad_temp0 / range_size);
-
-                auto grad_temp1{ to_float(abs(Vec8i().load_8us(&srcp[y * pitch + x + 8 + 0]) - Vec8i().load_8us(&srcp[y * pitch + x + 8 + 1]))) };
-                temp1 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 8 + 1]) - Vec8i().load_8us(&srcp[y * pitch + x + 8 + 2]));
-                temp1 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 8 + 2]) - Vec8i().load_8us(&srcp[y * pitch + x + 8 + 3]));
-                temp1 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 8 + 3]) - Vec8i().load_8us(&srcp[y * pitch + x + 8 + 4]));
-                temp1 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 8 - 0]) - Vec8i().load_8us(&srcp[y * pitch + x + 8 - 1]));
-                temp1 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 8 - 1]) - Vec8i().load_8us(&srcp[y * pitch + x + 8 - 2]));
-                temp1 += abs(Vec8i().load_8us(&srcp[y * pitch + x + 8 - 2]) - Vec8i().load_8us(&srcp[y * pitch + x + 8 - 3]));
-                grad_temp1 = select(temp1 > 0, grad_temp1 / to_float(temp1), grad_temp1 / range_size);
-
-                // use first row to store acculated results
-                (Vec8f().load(&grad[x]) + grad_temp0).store(&grad[x]);
-                (Vec8f().load(&grad[x + 8]) + grad_temp1).store(&grad[x + 8]);
-            }
+            (Vec8f().load(col_u + x) + normalized_gradient_avx2<T, range_size>(u + x, 1)).store(col_u + x);
+            (Vec8f().load(col_v + x) + normalized_gradient_avx2<T, range_size>(v + x, 1)).store(col_v + x);
         }
 
-        // find horizontal period
-        for (int period{ d->period_min }; period < d->period_max + 1; ++period)
+        for (; x < end; ++x)
         {
-            float temp;
-            float block{ 0.0f };
-            float nonblock{ 0.0f };
-            int block_count{ 0 };
-            int nonblock_count{ 0 };
-
-            for (int x{ 3 }; x < width - 4; ++x)
-            {
-                if ((x % period) == (period - 1))
-                {
-                    block += std::max(std::max(grad[x + 0], grad[x + 1]), grad[x - 1]);
-                    block_count++;
-                }
-                else
-                {
-                    nonblock += grad[x];
-                    nonblock_count++;
-                }
-            }
-
-            if (block_count && nonblock_count && nonblock)
-            {
-                temp = (block / block_count) / (nonblock / nonblock_count);
-                ret = std::max(ret, temp);
-            }
+            col_u[x] += normalized_gradient<T, range_size>(u + x, 1);
+            col_v[x] += normalized_gradient<T, range_size>(v + x, 1);
         }
+    }
 
-        // vertical blockiness (fixed height)
-        for (int y{ 3 }; y < height - 4; ++y)
+    // vertical blockiness (fixed height)
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
+    {
+        const T* u{ srcp_u + y * pitch };
+        const T* v{ srcp_v + y * pitch };
+        Vec8f sum_u{ zero_8f() };
+        Vec8f sum_v{ zero_8f() };
+        const int end{ std::min(x1, width) };
+        int x{ std::max(x0, 1) };
+
+        for (; x + 8 <= end; x += 8)
         {
-            for (int x{ 1 }; x < width; x += 16)
-            {
-                Vec8i temp0{ zero_si256() };
-                Vec8i temp1{ zero_si256() };
-
-                auto grad_temp0{ to_float(abs(Vec8i().load_8us(&srcp[(y + 0) * pitch + x]) - Vec8i().load_8us(&srcp[(y + 1) * pitch + x]))) };
-                temp0 += abs(Vec8i().load_8us(&srcp[(y + 1) * pitch + x]) - Vec8i().load_8us(&srcp[(y + 2) * pitch + x]));
-                temp0 += abs(Vec8i().load_8us(&srcp[(y + 2) * pitch + x]) - Vec8i().load_8us(&srcp[(y + 3) * pitch + x]));
-                temp0 += abs(Vec8i().load_8us(&srcp[(y + 3) * pitch + x]) - Vec8i().load_8us(&srcp[(y + 4) * pitch + x]));
-                temp0 += abs(Vec8i().load_8us(&srcp[(y - 0) * pitch + x]) - Vec8i().load_8us(&srcp[(y - 1) * pitch + x]));
-                temp0 += abs(Vec8i().load_8us(&srcp[(y - 1) * pitch + x]) - Vec8i().load_8us(&srcp[(y - 2) * pitch + x]));
-                temp0 += abs(Vec8i().load_8us(&srcp[(y - 2) * pitch + x]) - Vec8i().load_8us(&srcp[(y - 3) * pitch + x]));
-                grad_temp0 = select(temp0 > 0, grad_temp0 / to_float(temp0), grad_temp0 / range_size);
-
-                auto grad_temp1{ to_float(abs(Vec8i().load_8us(&srcp[(y + 0) * pitch + x + 8]) - Vec8i().load_8us(&srcp[(y + 1) * pitch + x + 8]))) };
-                temp1 += abs(Vec8i().load_8us(&srcp[(y + 1) * pitch + x + 8]) - Vec8i().load_8us(&srcp[(y + 2) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8us(&srcp[(y + 2) * pitch + x + 8]) - Vec8i().load_8us(&srcp[(y + 3) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8us(&srcp[(y + 3) * pitch + x + 8]) - Vec8i().load_8us(&srcp[(y + 4) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8us(&srcp[(y - 0) * pitch + x + 8]) - Vec8i().load_8us(&srcp[(y - 1) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8us(&srcp[(y - 1) * pitch + x + 8]) - Vec8i().load_8us(&srcp[(y - 2) * pitch + x + 8]));
-                temp1 += abs(Vec8i().load_8us(&srcp[(y - 2) * pitch + x + 8]) - Vec8i().load_8us(&srcp[(y - 3) * pitch + x + 8]));
-                grad_temp1 = select(temp1 > 0, grad_temp1 / to_float(temp1), grad_temp1 / range_size);
-
-                // use first column to store accumulated results
-                (Vec8f().load(&grad[y * width]) + grad_temp0).store(&grad[y * width]);
-                (Vec8f().load(&grad[y * width]) + grad_temp1).store(&grad[y * width]);
-            }
+            sum_u += normalized_gradient_avx2<T, range_size>(u + x, pitch);
+            sum_v += normalized_gradient_avx2<T, range_size>(v + x, pitch);
         }
 
-        // find vertical period
-        for (int period{ d->period_min }; period < d->period_max + 1; ++period)
+        row_u[y] += horizontal_add(sum_u);
+        row_v[y] += horizontal_add(sum_v);
+
+        for (; x < end; ++x)
         {
-            float temp;
-            float block{ 0.0f };
-            float nonblock{ 0.0f };
-            int block_count{ 0 };
-            int nonblock_count{ 0 };
-
-            for (int y{ 3 }; y < height - 4; y++)
-            {
-                if ((y % period) == (period - 1))
-                {
-                    block += std::max(std::max(grad[(y + 0) * width], grad[(y + 1) * width]), grad[(y - 1) * width]);
-                    block_count++;
-                }
-                else
-                {
-                    nonblock += grad[y * width];
-                    nonblock_count++;
-                }
-            }
-
-            if (block_count && nonblock_count && nonblock)
-            {
-                temp = (block / block_count) / (nonblock / nonblock_count);
-                ret = std::max(ret, temp);
-            }
+            row_u[y] += normalized_gradient<T, range_size>(u + x, pitch);
+            row_v[y] += normalized_gradient<T, range_size>(v + x, pitch);
         }
     }
+}
+
+template void calculate_profile_uv_avx2<uint8_t, 256>(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+template void calculate_profile_uv_avx2<uint16_t, 1024>(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+template void calculate_profile_uv_avx2<uint16_t, 4096>(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+template void calculate_profile_uv_avx2<uint16_t, 16384>(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+template void calculate_profile_uv_avx2<uint16_t, 65536>(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+template void calculate_profile_uv_avx2<float, 1>(AVS_VideoFrame* frame, const int x0, const int x1, const int y0, const int y1, float* col_u, float* row_u, float* col_v, float* row_v) noexcept;
+
+// Packed formats: the pixels of step samples are loaded as integers of step * sizeof(T) bytes and the sample is shifted down to the low bits,
+// so only the bytes of the 8 pixels are read.
+template <typename T, int step>
+static inline Vec8f load_packed(const T* srcp, const int shift) noexcept
+{
+    constexpr uint32_t mask{ (1u << (8 * sizeof(T))) - 1 };
+
+    if constexpr (step * sizeof(T) == 2)
+        return to_float(Vec8i((Vec8ui(Vec8i().load_8us(srcp)) >> shift) & Vec8ui(mask)));
+    else if constexpr (step * sizeof(T) == 4)
+        return to_float(Vec8i((Vec8ui().load(srcp) >> shift) & Vec8ui(mask)));
     else
+        return to_float(Vec8i(compress((Vec4uq().load(srcp) >> shift) & Vec4uq(mask), (Vec4uq().load(srcp + 4 * step) >> shift) & Vec4uq(mask))));
+}
+
+template <typename T, int range_size, int step>
+static inline Vec8f normalized_gradient_packed_avx2(const T* s, const ptrdiff_t stride, const int shift) noexcept
+{
+    auto l{ [&](const ptrdiff_t i) noexcept { return load_packed<T, step>(s + i * stride, shift); } };
+
+    const Vec8f m3{ l(-3) };
+    const Vec8f m2{ l(-2) };
+    const Vec8f m1{ l(-1) };
+    const Vec8f p0{ l(0) };
+    const Vec8f p1{ l(1) };
+    const Vec8f p2{ l(2) };
+    const Vec8f p3{ l(3) };
+    const Vec8f p4{ l(4) };
+
+    const Vec8f grad{ abs(p0 - p1) };
+    Vec8f temp{ abs(p1 - p2) };
+    temp += abs(p2 - p3);
+    temp += abs(p3 - p4);
+    temp += abs(p0 - m1);
+    temp += abs(m1 - m2);
+    temp += abs(m2 - m3);
+
+    return select(temp > 0.0f, grad / temp, grad / range_size);
+}
+
+// Profiles of the samples srcp[x * step + offset] of the rows srcp + y * pitch.
+template <typename T, int range_size, int step>
+static void packed_profile_avx2(const T* srcp, const ptrdiff_t pitch, const int offset, const int width, const int height,
+    const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    const int shift{ offset * 8 * static_cast<int>(sizeof(T)) };
+
+    // horizontal blockiness (fixed width)
+    for (int y{ std::max(y0, 1) }; y < y1; ++y)
     {
-        // Calculate BS in horizontal and vertical directions according to (1)(2)(3).
-         // Also try to find integer pixel periods (grids) even for scaled images.
-         // In case of fractional periods, FFMAX of current and neighbor pixels
-         // can help improve the correlation with MQS.
-         // Skip linear correction term (4)(5), as it appears only valid for their own test samples.
-
-         // horizontal blockiness (fixed width)
-        for (int y{ 1 }; y < height; ++y)
-        {
-            for (int x{ 3 }; x < width - 4; x += 8)
-            {
-                Vec8f temp0{ zero_8f() };
-
-                auto grad_temp0{ abs(Vec8f().load(&srcp[y * pitch + x + 0]) - Vec8f().load(&srcp[y * pitch + x + 1])) };
-                temp0 += abs(Vec8f().load(&srcp[y * pitch + x + 1]) - Vec8f().load(&srcp[y * pitch + x + 2]));
-                temp0 += abs(Vec8f().load(&srcp[y * pitch + x + 2]) - Vec8f().load(&srcp[y * pitch + x + 3]));
-                temp0 += abs(Vec8f().load(&srcp[y * pitch + x + 3]) - Vec8f().load(&srcp[y * pitch + x + 4]));
-                temp0 += abs(Vec8f().load(&srcp[y * pitch + x - 0]) - Vec8f().load(&srcp[y * pitch + x - 1]));
-                temp0 += abs(Vec8f().load(&srcp[y * pitch + x - 1]) - Vec8f().load(&srcp[y * pitch + x - 2]));
-                temp0 += abs(Vec8f().load(&srcp[y * pitch + x - 2]) - Vec8f().load(&srcp[y * pitch + x - 3]));
-                grad_temp0 = select(temp0 > 0, grad_temp0 / temp0, grad_temp0);
-
-                // use first row to store acculated results
-                (Vec8f().load(&grad[x]) + grad_temp0).store(&grad[x]);
-            }
-        }
+        const T* s{ srcp + y * pitch };
+        const int end{ std::min(x1, width - 4) };
+        int x{ std::max(x0, 3) };
 
-        // find horizontal period
-        for (int period{ d->period_min }; period < d->period_max + 1; ++period)
-        {
-            float temp;
-            float block{ 0.0f };
-            float nonblock{ 0.0f };
-            int block_count{ 0 };
-            int nonblock_count{ 0 };
-
-            for (int x{ 3 }; x < width - 4; ++x)
-            {
-                if ((x % period) == (period - 1))
-                {
-                    block += std::max(std::max(grad[x + 0], grad[x + 1]), grad[x - 1]);
-                    block_count++;
-                }
-                else
-                {
-                    nonblock += grad[x];
-                    nonblock_count++;
-                }
-            }
-
-            if (block_count && nonblock_count && nonblock)
-            {
-                temp = (block / block_count) / (nonblock / nonblock_count);
-                ret = std::max(ret, temp);
-            }
-        }
+        for (; x + 8 <= end; x += 8)
+            (Vec8f().load(col + x) + normalized_gradient_packed_avx2<T, range_size, step>(s + x * step, step, shift)).store(col + x);
 
-        // vertical blockiness (fixed height)
-        for (int y{ 3 }; y < height - 4; ++y)
-        {
-            for (int x{ 1 }; x < width; x += 8)
-            {
-                Vec8f temp0{ zero_8f() };
-
-                auto grad_temp0{ abs(Vec8f().load(&srcp[(y + 0) * pitch + x]) - Vec8f().load(&srcp[(y + 1) * pitch + x])) };
-                temp0 += abs(Vec8f().load(&srcp[(y + 1) * pitch + x]) - Vec8f().load(&srcp[(y + 2) * pitch + x]));
-                temp0 += abs(Vec8f().load(&srcp[(y + 2) * pitch + x]) - Vec8f().load(&srcp[(y + 3) * pitch + x]));
-                temp0 += abs(Vec8f().load(&srcp[(y + 3) * pitch + x]) - Vec8f().load(&srcp[(y + 4) * pitch + x]));
-                temp0 += abs(Vec8f().load(&srcp[(y - 0) * pitch + x]) - Vec8f().load(&srcp[(y - 1) * pitch + x]));
-                temp0 += abs(Vec8f().load(&srcp[(y - 1) * pitch + x]) - Vec8f().load(&srcp[(y - 2) * pitch + x]));
-                temp0 += abs(Vec8f().load(&srcp[(y - 2) * pitch + x]) - Vec8f().load(&srcp[(y - 3) * pitch + x]));
-                grad_temp0 = select(temp0 > 0, grad_temp0 / temp0, grad_temp0);
-
-                // use first column to store accumulated results
-                (Vec8f().load(&grad[y * width]) + grad_temp0).store(&grad[y * width]);
-            }
-        }
+        for (; x < end; ++x)
+            col[x] += normalized_gradient<T, range_size>(s + x * step + offset, step);
+    }
 
-        // find vertical period
-        for (int period{ d->period_min }; period < d->period_max + 1; ++period)
-        {
-            float temp;
-            float block{ 0.0f };
-            float nonblock{ 0.0f };
-            int block_count{ 0 };
-            int nonblock_count{ 0 };
-
-            for (int y{ 3 }; y < height - 4; y++)
-            {
-                if ((y % period) == (period - 1))
-                {
-                    block += std::max(std::max(grad[(y + 0) * width], grad[(y + 1) * width]), grad[(y - 1) * width]);
-                    block_count++;
-                }
-                else
-                {
-                    nonblock += grad[y * width];
-                    nonblock_count++;
-                }
-            }
-
-            if (block_count && nonblock_count && nonblock)
-            {
-                temp = (block / block_count) / (nonblock / nonblock_count);
-                ret = std::max(ret, temp);
-            }
-        }
+    // vertical blockiness (fixed height)
+    for (int y{ std::max(y0, 3) }; y < std::min(y1, height - 4); ++y)
+    {
+        const T* s{ srcp + y * pitch };
+        Vec8f sum{ zero_8f() };
+        const int end{ std::min(x1, width) };
+        int x{ std::max(x0, 1) };
+
+        for (; x + 8 <= end; x += 8)
+            sum += normalized_gradient_packed_avx2<T, range_size, step>(s + x * step, pitch, shift);
+
+        row[y] += horizontal_add(sum);
+
+        for (; x < end; ++x)
+            row[y] += normalized_gradient<T, range_size>(s + x * step + offset, pitch);
     }
+}
+
+// YUY2: Y0 U Y1 V.
+void calculate_profile_yuy2_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    const uint8_t* srcp{ avs_get_read_ptr_p(frame, AVS_DEFAULT_PLANE) };
+    const int pitch{ avs_get_pitch_p(frame, AVS_DEFAULT_PLANE) };
+    const int row_size{ avs_get_row_size_p(frame, AVS_DEFAULT_PLANE) };
+    const int height{ avs_get_height_p(frame, AVS_DEFAULT_PLANE) };
+
+    if (plane == AVS_PLANAR_Y)
+        packed_profile_avx2<uint8_t, 256, 2>(srcp, pitch, 0, row_size / 2, height, x0, x1, y0, y1, col, row);
+    else
+        packed_profile_avx2<uint8_t, 256, 4>(srcp, pitch, (plane == AVS_PLANAR_U) ? 1 : 3, row_size / 4, height, x0, x1, y0, y1, col, row);
+}
+
+// Packed RGB of 4 components (RGB32, RGB64): B G R A, bottom-up.
+template <typename T, int range_size>
+void calculate_profile_rgba_avx2(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept
+{
+    const ptrdiff_t pitch{ avs_get_pitch_p(frame, AVS_DEFAULT_PLANE) / static_cast<int>(sizeof(T)) };
+    const int width{ avs_get_row_size_p(frame, AVS_DEFAULT_PLANE) / static_cast<int>(sizeof(T)) / 4 };
+    const int height{ avs_get_height_p(frame, AVS_DEFAULT_PLANE) };
+    const int offset{ (plane == AVS_PLANAR_R) ? 2 : ((plane == AVS_PLANAR_G) ? 1 : ((plane == AVS_PLANAR_B) ? 0 : 3)) };
+
+    // start at the top row
+    const T* srcp{ reinterpret_cast<const T*>(avs_get_read_ptr_p(frame, AVS_DEFAULT_PLANE)) + (height - 1) * pitch };
 
-    // return highest value of horz||vert
-    return ret;
+    packed_profile_avx2<T, range_size, 4>(srcp, -pitch, offset, width, height, x0, x1, y0, y1, col, row);
 }
 
-template const float calculate_blockiness_avx2<uint8_t, 256>(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
-template const float calculate_blockiness_avx2<uint16_t, 1024>(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
-template const float calculate_blockiness_avx2<uint16_t, 4096>(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
-template const float calculate_blockiness_avx2<uint16_t, 16384>(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
-template const float calculate_blockiness_avx2<uint16_t, 65536>(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
-template const float calculate_blockiness_avx2<float, 1>(AVS_VideoFrame* frame, const blockdetect* d, const int plane) noexcept;
+template void calculate_profile_rgba_avx2<uint8_t, 256>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;
+template void calculate_profile_rgba_avx2<uint16_t, 65536>(AVS_VideoFrame* frame, const int plane, const int x0, const int x1, const int y0, const int y1, float* col, float* row) noexcept;